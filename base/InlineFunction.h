@@ -0,0 +1,103 @@
+#ifndef INLINEFUNCTION_H
+#define INLINEFUNCTION_H
+
+#include <stddef.h>
+#include <new>
+#include <type_traits>
+#include <utility>
+
+// 只可移动的函数对象，可调用对象就地存放在固定大小的缓冲区里，从不分配内存
+// 可调用对象超过 Capacity 时编译失败，而不是像 std::function 一样退化成堆分配
+template <typename Signature, size_t Capacity>
+class InlineFunction;
+
+template <typename R, typename... Args, size_t Capacity>
+class InlineFunction<R(Args...), Capacity> {
+ public:
+  InlineFunction() : ops_(NULL) {}
+  InlineFunction(std::nullptr_t) : ops_(NULL) {}
+
+  template <typename F,
+            typename = typename std::enable_if<!std::is_same<
+                typename std::decay<F>::type, InlineFunction>::value>::type>
+  InlineFunction(F&& f) {
+    typedef typename std::decay<F>::type Fn;
+    static_assert(sizeof(Fn) <= Capacity, "callable too large for InlineFunction");
+    static_assert(alignof(Fn) <= alignof(void*), "callable over-aligned for InlineFunction");
+    new (storage_) Fn(std::forward<F>(f));
+    ops_ = &OpsFor<Fn>::ops;
+  }
+
+  InlineFunction(InlineFunction&& rhs) noexcept : ops_(rhs.ops_) {
+    if (ops_) {
+      ops_->move(storage_, rhs.storage_);
+      rhs.ops_ = NULL;
+    }
+  }
+
+  InlineFunction& operator=(InlineFunction&& rhs) noexcept {
+    if (this != &rhs) {
+      reset();
+      if (rhs.ops_) {
+        rhs.ops_->move(storage_, rhs.storage_);
+        ops_ = rhs.ops_;
+        rhs.ops_ = NULL;
+      }
+    }
+    return *this;
+  }
+
+  InlineFunction& operator=(std::nullptr_t) {
+    reset();
+    return *this;
+  }
+
+  InlineFunction(const InlineFunction&) = delete;
+  InlineFunction& operator=(const InlineFunction&) = delete;
+
+  ~InlineFunction() { reset(); }
+
+  explicit operator bool() const { return ops_ != NULL; }
+
+  R operator()(Args... args) const {
+    return ops_->invoke(const_cast<unsigned char*>(storage_), std::forward<Args>(args)...);
+  }
+
+ private:
+  struct Ops {
+    R (*invoke)(void*, Args&&...);
+    void (*move)(void* dst, void* src);
+    void (*destroy)(void*);
+  };
+
+  template <typename Fn>
+  struct OpsFor {
+    static R invoke(void* p, Args&&... args) {
+      return (*static_cast<Fn*>(p))(std::forward<Args>(args)...);
+    }
+    static void move(void* dst, void* src) {
+      new (dst) Fn(std::move(*static_cast<Fn*>(src)));
+      static_cast<Fn*>(src)->~Fn();
+    }
+    static void destroy(void* p) { static_cast<Fn*>(p)->~Fn(); }
+    static const Ops ops;
+  };
+
+  void reset() {
+    if (ops_) {
+      ops_->destroy(storage_);
+      ops_ = NULL;
+    }
+  }
+
+  alignas(void*) unsigned char storage_[Capacity];
+  const Ops* ops_;
+};
+
+template <typename R, typename... Args, size_t Capacity>
+template <typename Fn>
+const typename InlineFunction<R(Args...), Capacity>::Ops
+    InlineFunction<R(Args...), Capacity>::OpsFor<Fn>::ops = {
+        &OpsFor<Fn>::invoke, &OpsFor<Fn>::move, &OpsFor<Fn>::destroy};
+
+#endif  // INLINEFUNCTION_H
@@ -0,0 +1,134 @@
+#ifndef MPSCQUEUE_H
+#define MPSCQUEUE_H
+
+#include <assert.h>
+#include <stddef.h>
+#include <atomic>
+#include <utility>
+
+#include "noncopyable.h"
+
+// 无锁多生产者单消费者队列（Vyukov 节点链表）
+// push 可在任意线程调用，pop 只能由唯一的消费者线程调用
+// 节点循环使用：消费者把用完的节点挂回 returned_，生产者线程缓存为空时整批取走，
+// 稳定运行后 push 不再分配内存
+template <typename T>
+class MpscQueue : noncopyable {
+ public:
+  MpscQueue() : head_(&stub_), tail_(&stub_), size_(0), returned_(NULL) {
+    stub_.next.store(NULL, std::memory_order_relaxed);
+  }
+
+  ~MpscQueue() {
+    T value;
+    while (pop(&value)) {
+    }
+    Node* node = returned_.exchange(NULL, std::memory_order_acquire);
+    while (node) {
+      Node* next = node->next.load(std::memory_order_relaxed);
+      delete node;
+      node = next;
+    }
+  }
+
+  void push(T&& value) {
+    Node* node = allocNode();
+    node->value = std::move(value);
+    pushNode(node);
+    // 链接完成后再计数，消费者看到的计数一定都能 pop 出来
+    size_.fetch_add(1, std::memory_order_release);
+  }
+
+  // 队列为空返回 false
+  bool pop(T* value) {
+    Node* head = head_;
+    Node* next = head->next.load(std::memory_order_acquire);
+    if (head == &stub_) {
+      if (next == NULL) return false;
+      head_ = next;
+      head = next;
+      next = next->next.load(std::memory_order_acquire);
+    }
+    if (next == NULL) {
+      if (head != tail_.load(std::memory_order_acquire)) {
+        // 生产者正在链接，稍后再取
+        return false;
+      }
+      pushNode(&stub_);
+      next = head->next.load(std::memory_order_acquire);
+      if (next == NULL) return false;
+    }
+    head_ = next;
+    *value = std::move(head->value);
+    recycle(head);
+    size_.fetch_sub(1, std::memory_order_relaxed);
+    return true;
+  }
+
+  // 计数在链接之后才增加，可能短暂落后于真实长度
+  size_t size() const {
+    long n = size_.load(std::memory_order_acquire);
+    return n > 0 ? static_cast<size_t>(n) : 0;
+  }
+  bool empty() const { return size() == 0; }
+
+ private:
+  struct Node {
+    Node() : next(NULL) {}
+    T value;
+    std::atomic<Node*> next;
+  };
+
+  // 每个生产者线程的空闲节点，线程退出时释放
+  struct NodeCache {
+    NodeCache() : head(NULL) {}
+    ~NodeCache() {
+      while (head) {
+        Node* next = head->next.load(std::memory_order_relaxed);
+        delete head;
+        head = next;
+      }
+    }
+    Node* head;
+  };
+
+  static NodeCache& localCache() {
+    static thread_local NodeCache cache;
+    return cache;
+  }
+
+  Node* allocNode() {
+    NodeCache& cache = localCache();
+    if (cache.head == NULL) {
+      // 整批取走不存在 ABA 问题
+      cache.head = returned_.exchange(NULL, std::memory_order_acquire);
+    }
+    Node* node = cache.head;
+    if (node == NULL) return new Node;
+    cache.head = node->next.load(std::memory_order_relaxed);
+    return node;
+  }
+
+  // 只有消费者调用，唯一的压入者，CAS 不会遇到 ABA
+  void recycle(Node* node) {
+    Node* head = returned_.load(std::memory_order_relaxed);
+    do {
+      node->next.store(head, std::memory_order_relaxed);
+    } while (!returned_.compare_exchange_weak(head, node, std::memory_order_release,
+                                              std::memory_order_relaxed));
+  }
+
+  void pushNode(Node* node) {
+    node->next.store(NULL, std::memory_order_relaxed);
+    Node* prev = tail_.exchange(node, std::memory_order_acq_rel);
+    prev->next.store(node, std::memory_order_release);
+  }
+
+  Node* head_;  // 只有消费者访问
+  std::atomic<Node*> tail_;
+  std::atomic<long> size_;
+  std::atomic<Node*> returned_;
+  Node stub_;
+};
+
+#endif  // MPSCQUEUE_H
@@ -3,8 +3,10 @@
 #include <assert.h>
 #include <errno.h>
 #include <linux/unistd.h>
+#include <sched.h>
 #include <stdint.h>
 #include <stdio.h>
+#include <string.h>
 #include <sys/prctl.h>
 #include <sys/types.h>
 #include <unistd.h>
@@ -23,13 +25,28 @@ struct ThreadData {
   string name_;
   pid_t* tid_;
   CountDownLatch* latch_;
+  int cpu_;
 
   ThreadData(const ThreadFunc& func, const string& name, pid_t* tid,
-             CountDownLatch* latch)
-      : func_(func), name_(name), tid_(tid), latch_(latch) {}
+             CountDownLatch* latch, int cpu)
+      : func_(func), name_(name), tid_(tid), latch_(latch), cpu_(cpu) {}
 
   void runInThread() 
   {
+    // 先绑核再运行线程函数，线程函数里首次写入的内存按 first-touch 落在本 NUMA 节点
+    if (cpu_ >= 0)
+    {
+      cpu_set_t set;
+      CPU_ZERO(&set);
+      CPU_SET(cpu_, &set);
+      int err = pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+      if (err != 0)
+      {
+        fprintf(stderr, "Thread %s failed to pin to cpu %d: %s\n",
+                name_.c_str(), cpu_, strerror(err));
+      }
+    }
+
     *tid_ = CurrentThread::tid();
     tid_ = NULL;
     latch_->countDown();
@@ -72,6 +89,7 @@ Thread::Thread(const ThreadFunc& func, const string& name)
       joined_(false),
       pthreadId_(0),
       tid_(0),
+      cpu_(-1),
       func_(func),
       name_(name),
       latch_(1) 
@@ -99,7 +117,7 @@ void Thread::start()
 {
   assert(!started_);
   started_ = true;
-  ThreadData* data = new ThreadData(func_, name_, &tid_, &latch_);
+  ThreadData* data = new ThreadData(func_, name_, &tid_, &latch_, cpu_);
   if (pthread_create(&pthreadId_, NULL, &startThread, data))
   {
     started_ = false;
@@ -17,11 +17,14 @@ class Thread : noncopyable {
   typedef std::function<void()> ThreadFunc;
   explicit Thread(const ThreadFunc&, const std::string& name = std::string());
   ~Thread();
+  // 在 start() 之前调用，线程函数运行前把线程绑定到该 CPU，-1 表示不绑定
+  void setCpuAffinity(int cpu) { cpu_ = cpu; }
   void start();
   int join();
   bool started() const { return started_; }
   pid_t tid() const { return tid_; }
   const std::string& name() const { return name_; }
+  int cpuAffinity() const { return cpu_; }
   static int numCreated() { return numCreated_.load(); }
 
  private:
@@ -30,6 +33,7 @@ class Thread : noncopyable {
   bool joined_;
   pthread_t pthreadId_;
   pid_t tid_;
+  int cpu_;
   ThreadFunc func_;
   std::string name_;
   CountDownLatch latch_;
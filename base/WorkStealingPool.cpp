@@ -0,0 +1,125 @@
+#include "WorkStealingPool.h"
+
+#include <assert.h>
+#include <stdio.h>
+
+namespace {
+// 当前线程所属的池和在池中的下标，不是工作线程时为 NULL
+__thread WorkStealingPool* t_pool = NULL;
+__thread int t_workerIndex = -1;
+}  // namespace
+
+WorkStealingPool::WorkStealingPool(const std::string& name, int numThreads)
+    : name_(name),
+      numThreads_(numThreads),
+      next_(0),
+      pending_(0),
+      mutex_(),
+      cond_(mutex_),
+      running_(false)
+{
+  assert(numThreads_ > 0);
+  for (int i = 0; i < numThreads_; ++i)
+  {
+    workers_.push_back(std::unique_ptr<Worker>(new Worker));
+  }
+}
+
+WorkStealingPool::~WorkStealingPool()
+{
+  if (running_) stop();
+}
+
+void WorkStealingPool::start()
+{
+  assert(threads_.empty());
+  running_ = true;
+  for (int i = 0; i < numThreads_; ++i)
+  {
+    char buf[name_.size() + 32];
+    snprintf(buf, sizeof buf, "%s%d", name_.c_str(), i);
+    threads_.push_back(std::unique_ptr<Thread>(
+        new Thread(std::bind(&WorkStealingPool::runInThread, this, i), buf)));
+    threads_.back()->start();
+  }
+}
+
+void WorkStealingPool::stop()
+{
+  {
+    MutexLockGuard lock(mutex_);
+    running_ = false;
+    cond_.notifyAll();
+  }
+  for (auto& thread : threads_)
+  {
+    thread->join();
+  }
+  threads_.clear();
+}
+
+void WorkStealingPool::submit(Task task)
+{
+  int index = t_pool == this
+                  ? t_workerIndex
+                  : static_cast<int>(next_.fetch_add(1, std::memory_order_relaxed) % numThreads_);
+  {
+    MutexLockGuard lock(workers_[index]->mutex);
+    workers_[index]->tasks.push_back(std::move(task));
+  }
+  // 先计数再在锁内通知，等待方在锁内检查计数，不会丢失唤醒
+  pending_.fetch_add(1, std::memory_order_release);
+  MutexLockGuard lock(mutex_);
+  cond_.notify();
+}
+
+bool WorkStealingPool::take(int index, Task* task)
+{
+  {
+    Worker& self = *workers_[index];
+    MutexLockGuard lock(self.mutex);
+    if (!self.tasks.empty())
+    {
+      *task = std::move(self.tasks.back());
+      self.tasks.pop_back();
+      return true;
+    }
+  }
+  for (int i = 1; i < numThreads_; ++i)
+  {
+    Worker& victim = *workers_[(index + i) % numThreads_];
+    MutexLockGuard lock(victim.mutex);
+    if (!victim.tasks.empty())
+    {
+      *task = std::move(victim.tasks.front());
+      victim.tasks.pop_front();
+      return true;
+    }
+  }
+  return false;
+}
+
+void WorkStealingPool::runInThread(int index)
+{
+  t_pool = this;
+  t_workerIndex = index;
+  Task task;
+  while (true)
+  {
+    if (take(index, &task))
+    {
+      pending_.fetch_sub(1, std::memory_order_relaxed);
+      task();
+      task = Task();
+      continue;
+    }
+    MutexLockGuard lock(mutex_);
+    while (pending_.load(std::memory_order_acquire) == 0 && running_)
+    {
+      cond_.wait();
+    }
+    if (pending_.load(std::memory_order_acquire) == 0 && !running_) break;
+  }
+  t_pool = NULL;
+  t_workerIndex = -1;
+}
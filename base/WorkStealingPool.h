@@ -0,0 +1,55 @@
+#ifndef WORKSTEALINGPOOL_H
+#define WORKSTEALINGPOOL_H
+
+#include <atomic>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "Condition.h"
+#include "Mutex.h"
+#include "Thread.h"
+#include "noncopyable.h"
+
+// 计算线程池，给 CPU 密集的任务用，不跑在 I/O 线程上
+// 每个工作线程有自己的任务队列，从队尾取；自己的队列空了就从其他队列的队头偷
+// 外部提交的任务轮流放进各个队列，工作线程里提交的任务放进自己的队列
+class WorkStealingPool : noncopyable {
+ public:
+  typedef std::function<void()> Task;
+
+  WorkStealingPool(const std::string& name, int numThreads);
+  ~WorkStealingPool();
+
+  void start();
+  // 等已经提交的任务执行完再退出
+  void stop();
+  // 任意线程可调用
+  void submit(Task task);
+
+  int numThreads() const { return numThreads_; }
+
+ private:
+  struct Worker {
+    MutexLock mutex;
+    std::deque<Task> tasks;
+  };
+
+  void runInThread(int index);
+  bool take(int index, Task* task);
+
+  const std::string name_;
+  const int numThreads_;
+  std::vector<std::unique_ptr<Worker>> workers_;
+  std::vector<std::unique_ptr<Thread>> threads_;
+  std::atomic<unsigned> next_;
+  // 已提交还没被取走的任务数，空闲线程据此睡眠
+  std::atomic<int> pending_;
+  MutexLock mutex_;
+  Condition cond_;
+  bool running_;
+};
+
+#endif  // WORKSTEALINGPOOL_H
@@ -0,0 +1,134 @@
+#include "Acceptor.h"
+#include "EventLoop.h"
+#include "base/Logging.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+
+Acceptor::Acceptor(EventLoop* loop, int listenFd)
+    : loop_(loop),
+      listenFd_(listenFd),
+      idleFd_(open("/dev/null", O_RDONLY | O_CLOEXEC)),
+      acceptCompletion_(false),
+      acceptChannel_(new Channel(loop, listenFd)) {
+  assert(idleFd_ >= 0);
+  acceptChannel_->setReadHandler(std::bind(&Acceptor::handleRead, this));
+}
+
+Acceptor::~Acceptor()
+{
+  loop_->assertInLoopThread();
+  acceptChannel_->disableAll();
+  acceptChannel_->remove();
+  close(idleFd_);
+}
+
+void Acceptor::listen()
+{
+  loop_->assertInLoopThread();
+  acceptCompletion_ = loop_->enableAcceptCompletion(listenFd_);
+  acceptChannel_->setET();
+  acceptChannel_->enableReading();
+}
+
+void Acceptor::handleRead()
+{
+  loop_->assertInLoopThread();
+  if (acceptCompletion_)
+  {
+    handleAccepted();
+    // 后端退回了就绪通知时继续走下面的 accept4 循环
+    if (acceptCompletion_) return;
+  }
+  struct sockaddr clientAddr;
+  memset(&clientAddr, 0, sizeof(struct sockaddr));
+  socklen_t addrLen = sizeof(clientAddr);
+  int connfd;
+  int accepted = 0;
+  while ((connfd = accept4(listenFd_, &clientAddr, &addrLen, SOCK_NONBLOCK | SOCK_CLOEXEC)) >= 0)
+  {
+    ++accepted;
+    if (newConnectionCallback_)
+    {
+      newConnectionCallback_(connfd, &clientAddr);
+    }
+    else
+    {
+      close(connfd);
+    }
+  }
+  handleAcceptError(errno);
+  if (accepted > 0 && acceptBurstCallback_)
+  {
+    acceptBurstCallback_();
+  }
+}
+
+void Acceptor::handleAccepted()
+{
+  accepted_.clear();
+  acceptCompletion_ = loop_->takeAccepted(listenFd_, &accepted_);
+  // 内核没有带回对端地址，回调需要时自己 getpeername
+  struct sockaddr clientAddr;
+  memset(&clientAddr, 0, sizeof(struct sockaddr));
+  clientAddr.sa_family = AF_UNSPEC;
+  int accepted = 0;
+  for (int connfd : accepted_)
+  {
+    if (connfd < 0)
+    {
+      handleAcceptError(-connfd);
+      continue;
+    }
+    ++accepted;
+    if (newConnectionCallback_)
+    {
+      newConnectionCallback_(connfd, &clientAddr);
+    }
+    else
+    {
+      close(connfd);
+    }
+  }
+  if (accepted > 0 && acceptBurstCallback_)
+  {
+    acceptBurstCallback_();
+  }
+}
+
+void Acceptor::handleAcceptError(int savedErrno)
+{
+  switch (savedErrno)
+  {
+    case EAGAIN:
+    case ECONNABORTED:
+    case EINTR:
+    case EPROTO:
+    case EPERM:
+    case EMFILE:
+      break;
+    case EBADF:
+    case EFAULT:
+    case EINVAL:
+    case ENFILE:
+    case ENOBUFS:
+    case ENOMEM:
+    case ENOTSOCK:
+    case EOPNOTSUPP:
+      // unexpected errors
+      LOG_FATAL << "unexpected error of accept4 " << savedErrno;
+      break;
+    default:
+      LOG_FATAL << "unknown error of accept4 " << savedErrno;
+      break;
+  }
+  if (savedErrno == EMFILE)
+  {
+    close(idleFd_);
+    idleFd_ = accept(listenFd_, NULL, NULL);
+    close(idleFd_);
+    idleFd_ = open("/dev/null", O_RDONLY | O_CLOEXEC);
+  }
+}
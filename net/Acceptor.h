@@ -0,0 +1,50 @@
+#ifndef ACCEPTOR_H
+#define ACCEPTOR_H
+
+#include "Channel.h"
+#include "base/InlineFunction.h"
+#include "base/noncopyable.h"
+
+#include <sys/socket.h>
+#include <memory>
+#include <vector>
+
+class EventLoop;
+
+// 监听 fd 上的接受循环，在所属 Loop 线程中运行
+// 主 Loop 上一个，或者 SO_REUSEPORT 模式下每个 I/O Loop 一个
+// io_uring 后端下由内核 multishot accept 接受连接，这里只取走结果，不再逐个调用 accept4
+class Acceptor : noncopyable {
+ public:
+  typedef InlineFunction<void(int connfd, const struct sockaddr* clientAddr), 48>
+      NewConnectionCallback;
+  typedef InlineFunction<void(), 32> AcceptBurstCallback;
+
+  // listenFd 已经 bind 并 listen
+  Acceptor(EventLoop* loop, int listenFd);
+  ~Acceptor();
+
+  void setNewConnectionCallback(NewConnectionCallback&& cb) { newConnectionCallback_ = std::move(cb); }
+  // 一次接受循环结束后调用（至少接受了一个连接），用于批量交出本轮的连接
+  void setAcceptBurstCallback(AcceptBurstCallback&& cb) { acceptBurstCallback_ = std::move(cb); }
+  // 开始接受连接，必须在 loop 线程中调用
+  void listen();
+  int getFd() const { return listenFd_; }
+  EventLoop* getLoop() const { return loop_; }
+
+ private:
+  void handleRead();
+  void handleAccepted();
+  void handleAcceptError(int savedErrno);
+
+  EventLoop* loop_;
+  const int listenFd_;
+  int idleFd_;
+  bool acceptCompletion_;
+  std::vector<int> accepted_;
+  std::unique_ptr<Channel> acceptChannel_;
+  NewConnectionCallback newConnectionCallback_;
+  AcceptBurstCallback acceptBurstCallback_;
+};
+
+#endif  // ACCEPTOR_H
@@ -10,15 +10,31 @@ const size_t Buffer::kInitialSize;
 
 ssize_t Buffer::readFd(int fd, int* savedErrno)
 {
-  char extrabuf[65536];
+  // 使用 Loop 共享的读缓冲区，没有内存池时才用栈上的
+  if (pool_ == NULL)
+  {
+    return readFdWithStackBuffer(fd, savedErrno);
+  }
+  return readFdInto(fd, pool_->scratch(), savedErrno);
+}
+
+ssize_t Buffer::readFdWithStackBuffer(int fd, int* savedErrno)
+{
+  char stackbuf[BufferPool::kScratchSize];
+  return readFdInto(fd, stackbuf, savedErrno);
+}
+
+ssize_t Buffer::readFdInto(int fd, char* extrabuf, int* savedErrno)
+{
+  const size_t extrasize = BufferPool::kScratchSize;
   struct iovec vec[2];
   const size_t writable = writableBytes();
   vec[0].iov_base = begin()+writerIndex_;
   vec[0].iov_len = writable;
   vec[1].iov_base = extrabuf;
-  vec[1].iov_len = sizeof(extrabuf);
+  vec[1].iov_len = extrasize;
   // 一次性尽可能读取多的数据
-  const int iovcnt = (writable < sizeof(extrabuf)) ? 2 : 1;
+  const int iovcnt = (writable < extrasize) ? 2 : 1;
   const ssize_t n = readv(fd, vec, iovcnt);
   if (n < 0)
   {
@@ -30,7 +46,7 @@ ssize_t Buffer::readFd(int fd, int* savedErrno)
   }
   else
   {
-    writerIndex_ = buffer_.size();
+    writerIndex_ = capacity_;
     append(extrabuf, n - writable);
   }
   return n;
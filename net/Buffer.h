@@ -1,10 +1,12 @@
 #ifndef BUFFER_H
 #define BUFFER_H
 
+#include "BufferPool.h"
+
 #include <algorithm>
-#include <vector>
 
 #include <assert.h>
+#include <stdlib.h>
 #include <string.h>
 #include <cstdint>
 
@@ -48,27 +50,77 @@ class Buffer
   static const size_t kInitialSize = 1024;
 
   explicit Buffer(size_t initialSize = kInitialSize)
-    : buffer_(kCheapPrepend + initialSize),
+    : buffer_(NULL),
+      capacity_(0),
       readerIndex_(kCheapPrepend),
-      writerIndex_(kCheapPrepend)
+      writerIndex_(kCheapPrepend),
+      pool_(NULL)
   {
+    allocate(kCheapPrepend + initialSize);
     assert(readableBytes() == 0);
     assert(writableBytes() == initialSize);
     assert(prependableBytes() == kCheapPrepend);
   }
 
+  // 从 Loop 的内存池取存储，第一次写入时才真正分配
+  explicit Buffer(BufferPool* pool)
+    : buffer_(NULL),
+      capacity_(0),
+      readerIndex_(0),
+      writerIndex_(0),
+      pool_(pool)
+  {
+  }
+
+  ~Buffer()
+  {
+    releaseStorage();
+  }
+
+  Buffer(const Buffer&) = delete;
+  Buffer& operator=(const Buffer&) = delete;
+
   void swap(Buffer& rhs)
   {
-    buffer_.swap(rhs.buffer_);
+    std::swap(buffer_, rhs.buffer_);
+    std::swap(capacity_, rhs.capacity_);
     std::swap(readerIndex_, rhs.readerIndex_);
     std::swap(writerIndex_, rhs.writerIndex_);
+    std::swap(pool_, rhs.pool_);
+  }
+
+  // 归还存储，之后的写入会重新分配
+  void releaseStorage()
+  {
+    if (buffer_)
+    {
+      if (pool_)
+        pool_->deallocate(buffer_, capacity_);
+      else
+        ::free(buffer_);
+    }
+    buffer_ = NULL;
+    capacity_ = 0;
+    readerIndex_ = 0;
+    writerIndex_ = 0;
   }
 
+  // 换用另一个内存池，先把存储归还给原来的池，只能在原池所属线程调用
+  void resetPool(BufferPool* pool)
+  {
+    assert(readableBytes() == 0);
+    releaseStorage();
+    pool_ = pool;
+  }
+
+  bool hasStorage() const
+  { return buffer_ != NULL; }
+
   size_t readableBytes() const
   { return writerIndex_ - readerIndex_; }
 
   size_t writableBytes() const
-  { return buffer_.size() - writerIndex_; }
+  { return capacity_ - writerIndex_; }
 
   size_t prependableBytes() const
   { return readerIndex_; }
@@ -148,8 +200,11 @@ class Buffer
 
   void retrieveAll()
   {
-    readerIndex_ = kCheapPrepend;
-    writerIndex_ = kCheapPrepend;
+    if (buffer_)
+    {
+      readerIndex_ = kCheapPrepend;
+      writerIndex_ = kCheapPrepend;
+    }
   }
 
   std::string retrieveAllAsString()
@@ -327,7 +382,7 @@ class Buffer
 
   void shrink(size_t reserve)
   {
-    Buffer other;
+    Buffer other(pool_);
     other.ensureWritableBytes(readableBytes()+reserve);
     other.append(toStringView());
     swap(other);
@@ -335,32 +390,59 @@ class Buffer
 
   size_t internalCapacity() const
   {
-    return buffer_.capacity();
+    return capacity_;
   }
 
   ssize_t readFd(int fd, int* savedErrno);
 
  private:
+  ssize_t readFdInto(int fd, char* extrabuf, int* savedErrno);
+  // 没有内存池时才用，64KB 的栈帧只在这里出现
+  ssize_t readFdWithStackBuffer(int fd, int* savedErrno) __attribute__((noinline, cold));
 
   char* begin()
-  { return &*buffer_.begin(); }
+  { return buffer_; }
 
   const char* begin() const
-  { return &*buffer_.begin(); }
+  { return buffer_; }
+
+  void allocate(size_t size)
+  {
+    assert(buffer_ == NULL);
+    if (pool_)
+    {
+      buffer_ = pool_->allocate(size, &capacity_);
+    }
+    else
+    {
+      buffer_ = static_cast<char*>(::malloc(size));
+      capacity_ = size;
+    }
+    assert(buffer_ != NULL);
+    readerIndex_ = kCheapPrepend;
+    writerIndex_ = kCheapPrepend;
+  }
 
   void makeSpace(size_t len)
   {
-    if (writableBytes() + prependableBytes() < len + kCheapPrepend)
+    if (buffer_ == NULL)
+    {
+      allocate(std::max(kCheapPrepend + len, kInitialSize));
+    }
+    else if (writableBytes() + prependableBytes() < len + kCheapPrepend)
     {
-      buffer_.resize(writerIndex_+len);
+      // 扩容不做零初始化，只拷贝可读部分
+      Buffer other(pool_);
+      other.allocate(std::max(kCheapPrepend + readableBytes() + len, capacity_ * 2));
+      memcpy(other.beginWrite(), peek(), readableBytes());
+      other.hasWritten(readableBytes());
+      swap(other);
     }
     else
     {
       assert(kCheapPrepend < readerIndex_);
       size_t readable = readableBytes();
-      std::copy(begin()+readerIndex_,
-                begin()+writerIndex_,
-                begin()+kCheapPrepend);
+      memmove(begin()+kCheapPrepend, begin()+readerIndex_, readable);
       readerIndex_ = kCheapPrepend;
       writerIndex_ = readerIndex_ + readable;
       assert(readable == readableBytes());
@@ -368,9 +450,11 @@ class Buffer
   }
 
  private:
-  std::vector<char> buffer_;
+  char* buffer_;
+  size_t capacity_;
   size_t readerIndex_;
   size_t writerIndex_;
+  BufferPool* pool_;
 
   static const char kCRLF[];
 };
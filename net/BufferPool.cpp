@@ -0,0 +1,121 @@
+#include "BufferPool.h"
+#include "base/Logging.h"
+
+#include <assert.h>
+#include <stdlib.h>
+#include <algorithm>
+
+const size_t BufferPool::kMinBlockSize;
+const size_t BufferPool::kSlabSize;
+const int BufferPool::kNumSizeClasses;
+const size_t BufferPool::kScratchSize;
+
+BufferPool::BufferPool()
+    : slabBytes_(0)
+{
+  for (int i = 0; i < kNumSizeClasses; ++i)
+  {
+    freeLists_[i] = NULL;
+    inUse_[i] = 0;
+  }
+}
+
+BufferPool::~BufferPool()
+{
+  for (int i = 0; i < kNumSizeClasses; ++i)
+  {
+    for (char* slab : slabs_[i]) ::free(slab);
+  }
+}
+
+int BufferPool::sizeClass(size_t size)
+{
+  int cls = 0;
+  size_t blockSize = kMinBlockSize;
+  while (blockSize < size && cls < kNumSizeClasses)
+  {
+    blockSize <<= 1;
+    ++cls;
+  }
+  return cls;
+}
+
+size_t BufferPool::slabSize(int cls)
+{
+  return std::max(kSlabSize, kMinBlockSize << cls);
+}
+
+void BufferPool::refill(int cls)
+{
+  char* slab = static_cast<char*>(::malloc(slabSize(cls)));
+  if (slab == NULL)
+  {
+    LOG_SYSFATAL << "BufferPool::refill";
+  }
+  slabs_[cls].push_back(slab);
+  slabBytes_ += slabSize(cls);
+  carve(cls, slab);
+}
+
+// 切分 slab 并挂到空闲链表
+void BufferPool::carve(int cls, char* slab)
+{
+  const size_t blockSize = kMinBlockSize << cls;
+  for (size_t offset = 0; offset + blockSize <= slabSize(cls); offset += blockSize)
+  {
+    FreeBlock* block = reinterpret_cast<FreeBlock*>(slab + offset);
+    block->next = freeLists_[cls];
+    freeLists_[cls] = block;
+  }
+}
+
+// 这一级的块全部空闲，留下第一个 slab 重新切分，其余释放
+// 留一个是为了只有零星分配的级别不会每次都 malloc/free 整个 slab
+void BufferPool::trim(int cls)
+{
+  assert(inUse_[cls] == 0);
+  std::vector<char*>& slabs = slabs_[cls];
+  if (slabs.size() <= 1) return;
+  for (size_t i = 1; i < slabs.size(); ++i) ::free(slabs[i]);
+  slabBytes_ -= (slabs.size() - 1) * slabSize(cls);
+  slabs.resize(1);
+  freeLists_[cls] = NULL;
+  carve(cls, slabs[0]);
+}
+
+char* BufferPool::allocate(size_t size, size_t* capacity)
+{
+  const int cls = sizeClass(size);
+  if (cls == kNumSizeClasses)
+  {
+    char* block = static_cast<char*>(::malloc(size));
+    if (block == NULL)
+    {
+      LOG_SYSFATAL << "BufferPool::allocate";
+    }
+    *capacity = size;
+    return block;
+  }
+  if (freeLists_[cls] == NULL) refill(cls);
+  FreeBlock* block = freeLists_[cls];
+  freeLists_[cls] = block->next;
+  ++inUse_[cls];
+  *capacity = kMinBlockSize << cls;
+  return reinterpret_cast<char*>(block);
+}
+
+void BufferPool::deallocate(char* block, size_t capacity)
+{
+  const int cls = sizeClass(capacity);
+  if (cls == kNumSizeClasses)
+  {
+    ::free(block);
+    return;
+  }
+  assert(capacity == kMinBlockSize << cls);
+  FreeBlock* freeBlock = reinterpret_cast<FreeBlock*>(block);
+  freeBlock->next = freeLists_[cls];
+  freeLists_[cls] = freeBlock;
+  assert(inUse_[cls] > 0);
+  if (--inUse_[cls] == 0) trim(cls);
+}
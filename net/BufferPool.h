@@ -0,0 +1,53 @@
+#ifndef BUFFERPOOL_H
+#define BUFFERPOOL_H
+
+#include "base/noncopyable.h"
+
+#include <stddef.h>
+#include <vector>
+
+// 每个 EventLoop 一个，按 2 的幂分级的 slab 内存池，只能在所属 Loop 线程使用
+// 块从 64KB 的 slab（最大一级是一块一个 slab）中切分，归还后挂到对应级别的空闲链表
+// 某一级的块全部归还时只留一个 slab，其余还给 malloc，突发过后内存不会一直占着
+// 超过最大级别的请求直接走 malloc/free
+class BufferPool : noncopyable {
+ public:
+  static const size_t kMinBlockSize = 1024;
+  static const size_t kSlabSize = 64 * 1024;
+  // 1K 2K 4K ... 128K，最大一级能放下一次读满 scratch 的数据加上 Buffer 的预留头部
+  static const int kNumSizeClasses = 8;
+  static const size_t kScratchSize = 64 * 1024;
+
+  BufferPool();
+  ~BufferPool();
+
+  // 返回至少 size 字节的块，实际可用大小写入 *capacity
+  char* allocate(size_t size, size_t* capacity);
+  // capacity 必须是 allocate 返回的大小
+  void deallocate(char* block, size_t capacity);
+
+  size_t slabBytes() const { return slabBytes_; }
+
+  // Loop 内所有连接共用的读缓冲区，readv 先读到这里再按实际长度拷进连接的 Buffer
+  char* scratch() { return scratch_; }
+
+ private:
+  struct FreeBlock {
+    FreeBlock* next;
+  };
+
+  static int sizeClass(size_t size);
+  static size_t slabSize(int sizeClass);
+  void refill(int sizeClass);
+  void carve(int sizeClass, char* slab);
+  void trim(int sizeClass);
+
+  FreeBlock* freeLists_[kNumSizeClasses];
+  // 每一级分出去还没归还的块数
+  size_t inUse_[kNumSizeClasses];
+  std::vector<char*> slabs_[kNumSizeClasses];
+  size_t slabBytes_;
+  char scratch_[kScratchSize];
+};
+
+#endif  // BUFFERPOOL_H
@@ -12,6 +12,7 @@ Channel::Channel(EventLoop* loop, int fd)
       events_(0),
       revents_(0),
       state_(-1),
+      pendingIndex_(-1),
       tied_(false),
       eventHandling_(false),
       addedToLoop_(false) {}
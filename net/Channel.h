@@ -1,8 +1,10 @@
 #ifndef CHANNEL_H
 #define CHANNEL_H
 
+#include "base/InlineFunction.h"
 #include "base/noncopyable.h"
 
+#include <assert.h>
 #include <sys/epoll.h>
 #include <functional>
 #include <memory>
@@ -11,12 +13,18 @@ class EventLoop;
 
 class Channel : noncopyable {
  public:
-  typedef std::function<void()> EventCallback;
+  // 足够放下 std::bind(&Class::method, this)，不分配内存
+  typedef InlineFunction<void(), 32> EventCallback;
 
   Channel(EventLoop* loop, int fd);
   ~Channel();
 
   EventLoop* getLoop() { return loop_; }
+  // 连接迁移时换到另一个 Loop，调用前必须已经从原 Loop 中 remove
+  void setLoop(EventLoop* loop) {
+    assert(!addedToLoop_);
+    loop_ = loop;
+  }
   int getFd() { return fd_; };
   uint32_t getEvents() { return events_; }
 
@@ -49,16 +57,19 @@ class Channel : noncopyable {
   void setRevents(int revt) { revents_ = revt; }
   int getState() { return state_; }
   void setState(int state) { state_ = state; }
+  // 在 EventLoop 待提交更新列表中的位置，-1 表示没有待提交的更新
+  int getPendingIndex() { return pendingIndex_; }
+  void setPendingIndex(int index) { pendingIndex_ = index; }
   void setTie(const std::shared_ptr<void>& obj) {
     tie_ = obj;
     tied_ = true;
   }
   std::shared_ptr<void> getTie() { return tie_.lock(); }
 
-  void setReadHandler(EventCallback&& cb) { readHandler_ = cb; }
-  void setWriteHandler(EventCallback&& cb) { writeHandler_ = cb; }
-  void setErrorHandler(EventCallback&& cb) { errorHandler_ = cb; }
-  void setCloseHandler(EventCallback&& cb) { closeHandler_ = cb; }
+  void setReadHandler(EventCallback&& cb) { readHandler_ = std::move(cb); }
+  void setWriteHandler(EventCallback&& cb) { writeHandler_ = std::move(cb); }
+  void setErrorHandler(EventCallback&& cb) { errorHandler_ = std::move(cb); }
+  void setCloseHandler(EventCallback&& cb) { closeHandler_ = std::move(cb); }
 
   // handle event
   void handleEvents();
@@ -82,6 +93,7 @@ class Channel : noncopyable {
   uint32_t events_;
   uint32_t revents_;
   int state_;
+  int pendingIndex_;
 
   // 连接的一个 weak_ptr 指针，确保在处理事件时连接不被销毁
   std::weak_ptr<void> tie_;
@@ -0,0 +1,74 @@
+#include "ConnectionPool.h"
+#include "base/CurrentThread.h"
+#include "base/Logging.h"
+
+#include <stdlib.h>
+
+const int ConnectionPool::kBlocksPerSlab;
+
+ConnectionPool::ConnectionPool()
+    : ownerTid_(CurrentThread::tid()),
+      blockSize_(0),
+      freeList_(NULL),
+      remoteFreeList_(NULL)
+{
+}
+
+ConnectionPool::~ConnectionPool()
+{
+  for (char* slab : slabs_) ::free(slab);
+}
+
+void ConnectionPool::refill()
+{
+  char* slab = static_cast<char*>(::malloc(kBlocksPerSlab * blockSize_));
+  if (slab == NULL)
+  {
+    LOG_SYSFATAL << "ConnectionPool::refill";
+  }
+  slabs_.push_back(slab);
+  for (int i = 0; i < kBlocksPerSlab; ++i)
+  {
+    FreeBlock* block = reinterpret_cast<FreeBlock*>(slab + i * blockSize_);
+    block->next = freeList_;
+    freeList_ = block;
+  }
+}
+
+void* ConnectionPool::allocate(size_t size)
+{
+  assert(CurrentThread::tid() == ownerTid_);
+  if (blockSize_ == 0)
+  {
+    // 按 malloc 的对齐取整
+    const size_t align = alignof(max_align_t);
+    blockSize_ = (size + align - 1) / align * align;
+  }
+  assert(size <= blockSize_);
+  if (freeList_ == NULL)
+  {
+    // 整批取走，不存在 ABA 问题
+    freeList_ = remoteFreeList_.exchange(NULL, std::memory_order_acquire);
+  }
+  if (freeList_ == NULL) refill();
+  FreeBlock* block = freeList_;
+  freeList_ = block->next;
+  return block;
+}
+
+void ConnectionPool::deallocate(void* p)
+{
+  FreeBlock* block = static_cast<FreeBlock*>(p);
+  if (CurrentThread::tid() == ownerTid_)
+  {
+    block->next = freeList_;
+    freeList_ = block;
+    return;
+  }
+  FreeBlock* head = remoteFreeList_.load(std::memory_order_relaxed);
+  do
+  {
+    block->next = head;
+  } while (!remoteFreeList_.compare_exchange_weak(head, block, std::memory_order_release,
+                                                  std::memory_order_relaxed));
+}
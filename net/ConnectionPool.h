@@ -0,0 +1,76 @@
+#ifndef CONNECTIONPOOL_H
+#define CONNECTIONPOOL_H
+
+#include "base/noncopyable.h"
+
+#include <assert.h>
+#include <stddef.h>
+#include <atomic>
+#include <memory>
+#include <vector>
+
+// 每个 EventLoop 一个，连接对象（连同 shared_ptr 控制块）的定长 slab 池
+// 只在所属 Loop 线程分配，块大小由第一次分配决定
+// 连接迁移或计算任务可能让最后一个引用在其他线程释放，这些块先压进无锁的远程释放栈，
+// 由 Loop 线程在本地空闲链表用完时整批收回
+class ConnectionPool : noncopyable {
+ public:
+  static const int kBlocksPerSlab = 64;
+
+  ConnectionPool();
+  ~ConnectionPool();
+
+  void* allocate(size_t size);
+  // 任意线程可调用
+  void deallocate(void* block);
+
+  size_t slabBytes() const { return slabs_.size() * kBlocksPerSlab * blockSize_; }
+
+ private:
+  struct FreeBlock {
+    FreeBlock* next;
+  };
+
+  void refill();
+
+  const int ownerTid_;
+  size_t blockSize_;
+  FreeBlock* freeList_;
+  std::atomic<FreeBlock*> remoteFreeList_;
+  std::vector<char*> slabs_;
+};
+
+// 配合 std::allocate_shared 使用，对象和控制块一次从池中分配
+// 控制块里保存的分配器副本持有池的引用，池在最后一个对象释放后才析构
+template <typename T>
+class PoolAllocator {
+ public:
+  typedef T value_type;
+
+  explicit PoolAllocator(const std::shared_ptr<ConnectionPool>& pool) : pool_(pool) {}
+  template <typename U>
+  PoolAllocator(const PoolAllocator<U>& rhs) : pool_(rhs.pool()) {}
+
+  T* allocate(size_t n) {
+    assert(n == 1);
+    return static_cast<T*>(pool_->allocate(sizeof(T)));
+  }
+  void deallocate(T* p, size_t) { pool_->deallocate(p); }
+
+  const std::shared_ptr<ConnectionPool>& pool() const { return pool_; }
+
+ private:
+  std::shared_ptr<ConnectionPool> pool_;
+};
+
+template <typename T, typename U>
+bool operator==(const PoolAllocator<T>& lhs, const PoolAllocator<U>& rhs) {
+  return lhs.pool() == rhs.pool();
+}
+
+template <typename T, typename U>
+bool operator!=(const PoolAllocator<T>& lhs, const PoolAllocator<U>& rhs) {
+  return !(lhs == rhs);
+}
+
+#endif  // CONNECTIONPOOL_H
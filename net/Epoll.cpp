@@ -6,58 +6,14 @@
 
 using namespace std;
 
-const int EVENTSNUM = 4096;
-const int EPOLLWAIT_TIME = 10000;
-
-namespace {
-const int kNew = -1;
-const int kAdded = 1;
-const int kDeleted = 2;
-}  // namespace
-
 Epoll::Epoll(EventLoop* loop)
-    : loop_(loop),
+    : Poller(loop),
       epollFd_(epoll_create1(EPOLL_CLOEXEC)),
       events_(kInitEventListSize) {
   assert(epollFd_ >= 0);
 }
 Epoll::~Epoll() { close(epollFd_); }
 
-void Epoll::updateChannel(Channel* channel) {
-  assertInLoopThread();
-  const int fd = channel->getFd(), state = channel->getState();
-  if (state == kNew || state == kDeleted)
-  {
-    if (state == kNew)
-    {
-      assert(channels_.find(fd) == channels_.end());
-      channels_[fd] = channel;
-    } 
-    else
-    {
-      assert(channels_.find(fd) != channels_.end());
-      assert(channels_[fd] == channel);
-    }
-    channel->setState(kAdded);
-    update(EPOLL_CTL_ADD, channel);
-  }
-  else
-  {
-    assert(state == kAdded);
-    assert(channels_.find(fd) != channels_.end());
-    assert(channels_[fd] == channel);
-    if (channel->isNoneEvent())
-    {
-      channel->setState(kDeleted);
-      update(EPOLL_CTL_DEL, channel);
-    } 
-    else 
-    {
-      update(EPOLL_CTL_MOD, channel);
-    }
-  }
-}
-
 void Epoll::update(int operation, Channel* channel) {
   int fd = channel->getFd();
   struct epoll_event event;
@@ -83,28 +39,7 @@ void Epoll::update(int operation, Channel* channel) {
   }
 }
 
-void Epoll::removeChannel(Channel* channel) {
-  assertInLoopThread();
-  const int state = channel->getState(), fd = channel->getFd();
-  assert(channels_.find(fd) != channels_.end());
-  assert(channels_[fd] == channel);
-  assert(channel->isNoneEvent());
-  assert(state == kDeleted || state == kAdded);
-  [[maybe_unused]] size_t n = channels_.erase(fd);
-  assert(n == 1);
-  if (state == kAdded) {
-    update(EPOLL_CTL_DEL, channel);
-  }
-  channel->setState(kNew);
-}
-
-bool Epoll::hasChannel(Channel* channel) const {
-  assertInLoopThread();
-  ChannelMap::const_iterator it = channels_.find(channel->getFd());
-  return it != channels_.end() && it->second == channel;
-}
-
-void Epoll::poll(int timeout, ChannelList* activeChannels) {
+int Epoll::poll(int timeout) {
   assertInLoopThread();
   int numEvents;
   if ((numEvents = epoll_wait(epollFd_, &*events_.begin(),
@@ -114,35 +49,21 @@ void Epoll::poll(int timeout, ChannelList* activeChannels) {
       // error happened
       LOG_SYSERR << "EPollPoller::poll()";
     }
+    numEvents = 0;
   } 
   else if (numEvents > 0)
   {
-    fillActiveChannels(numEvents, activeChannels);
     if (numEvents == static_cast<int>(events_.size()))
       events_.resize(events_.size() << 1);
   } else {
     // nothing happened
   }
+  return numEvents;
 }
 
-void Epoll::fillActiveChannels(int numEvents,
-                               ChannelList* activeChannels) const {
-  int i;
-  epoll_event event;
-  Channel* channel;
-  for (i = 0; i < numEvents; ++i) {
-    event = events_[i];
-    channel = static_cast<Channel*>(event.data.ptr);
-    channel->setRevents(event.events);
-    activeChannels->push_back(channel);
+bool Epoll::hasPendingEvent(Channel* channel, int from, int numEvents) const {
+  for (int i = from; i < numEvents; ++i) {
+    if (events_[i].data.ptr == channel) return true;
   }
-}
-
-void Epoll::add_timer(Channel *channel, int timeout)
-{
-  HttpServerPtr t = std::static_pointer_cast<HttpServer>(channel->getTie());
-  if (t)
-    timerManager_.addTimer(t, timeout);
-  else
-    LOG_INFO << "timer add fail";
+  return false;
 }
@@ -1,10 +1,18 @@
 #include "EventLoop.h"
+#include "BufferPool.h"
 #include "Channel.h"
-#include "Epoll.h"
+#include "ConnectionPool.h"
+#include "HttpServer.h"
+#include "Poller.h"
+#include "Timer.h"
+#include "ZeroCopyLinger.h"
 #include "base/Logging.h"
 
+#include <limits.h>
 #include <sys/eventfd.h>
+#include <time.h>
 #include <unistd.h>
+#include <algorithm>
 
 using namespace std;
 
@@ -12,6 +20,8 @@ namespace {
 __thread EventLoop* t_loopInThisThread = 0;
 
 const int kPollTimeMs = 10000;
+// 每轮耗时移动平均的平滑系数 1/8
+const int kLatencyEwmaShift = 3;
 
 int createEventfd() {
   int evtfd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
@@ -22,18 +32,51 @@ int createEventfd() {
   return evtfd;
 }
 
+int64_t monotonicMicroseconds() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return static_cast<int64_t>(ts.tv_sec) * 1000000 + ts.tv_nsec / 1000;
+}
+
 }  // namespace
 
+// runAt/runAfter/runEvery 使用的定时器对象，从分配到回收由 EventLoop 管理
+struct LoopTimer {
+  enum State { kFree, kPending, kArmed, kRunning, kCancelled };
+
+  LoopTimer() : intervalMs(0), sequence(0), state(kFree), nextFree(NULL) {}
+
+  TimerNode node;
+  EventLoop::Functor callback;
+  int intervalMs;  // 0 表示只触发一次
+  uint32_t sequence;
+  // 分配之后只在 Loop 线程中修改
+  State state;
+  LoopTimer* nextFree;
+};
+
 EventLoop::EventLoop()
     : looping_(false),
       quit_(false),
       eventHandling_(false),
-      callingPendingFunctors_(false),
       threadId_(CurrentThread::tid()),
-      poller_(new Epoll(this)),
+      busyPollBudgetUs_(0),
+      slowCallbackUs_(0),
+      poller_(Poller::newDefaultPoller(this)),
+      timerManager_(new TimerManager()),
+      bufferPool_(new BufferPool()),
+      connectionPool_(std::make_shared<ConnectionPool>()),
       wakeupFd_(createEventfd()),
       wakeupChannel_(new Channel(this, wakeupFd_)),
-      currentActiveChannel_(NULL) {
+      zeroCopyLinger_(new ZeroCopyLinger(this)),
+      numActiveEvents_(0),
+      activeIndex_(0),
+      currentActiveChannel_(NULL),
+      wakeupPending_(true),
+      numConnections_(0),
+      numIncomingConnections_(0),
+      loopLatencyUs_(0),
+      freeTimers_(NULL) {
   if (t_loopInThisThread)
   {
     LOG_FATAL << "Another EventLoop " << t_loopInThisThread << " exists in this thread " << threadId_;
@@ -47,6 +90,10 @@ EventLoop::EventLoop()
 }
 
 EventLoop::~EventLoop() {
+  zeroCopyLinger_.reset();
+  for (const std::unique_ptr<LoopTimer>& timer : timers_) {
+    timerManager_->cancelTimer(&timer->node);
+  }
   wakeupChannel_->disableAll();
   wakeupChannel_->remove();
   close(wakeupFd_);
@@ -58,19 +105,68 @@ void EventLoop::loop() {
   assert(!looping_);
   looping_ = true;
   quit_ = false;
+  int64_t lastActiveUs = 0;
 
   while (!quit_) {
-    activeChannels_.clear();
-    poller_->poll(kPollTimeMs, &activeChannels_);
+    applyChannelUpdates();
+    // 睡到最近的定时器到期为止，到期的连接按时回收
+    int timeoutMs = kPollTimeMs;
+    const int timerMs = timerManager_->nextTimeout();
+    if (timerMs >= 0 && timerMs < timeoutMs) {
+      timeoutMs = timerMs;
+    }
+    if (busyPollBudgetUs_ > 0 &&
+        monotonicMicroseconds() - lastActiveUs < busyPollBudgetUs_) {
+      timeoutMs = 0;
+    }
+    // 即将睡眠，之后入队的生产者需要写 eventfd；与 queueInLoop 中的屏障配对
+    wakeupPending_.store(false, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (!pendingFunctors_.empty()) {
+      timeoutMs = 0;
+    }
+    const int64_t pollStartUs = monotonicMicroseconds();
+    numActiveEvents_ = poller_->poll(timeoutMs);
+    wakeupPending_.store(true, std::memory_order_relaxed);
+    const int64_t pollReturnUs = monotonicMicroseconds();
+    stats_.pollWaitUs.record(pollReturnUs - pollStartUs);
+    stats_.readyEvents.record(numActiveEvents_);
+    if (numActiveEvents_ > 0) {
+      lastActiveUs = pollReturnUs;
+    }
     eventHandling_ = true;
-    for (Channel* channel : activeChannels_) {
-      currentActiveChannel_ = channel;
-      currentActiveChannel_->handleEvents();
+    // 直接从 epoll_event 数组分发
+    for (activeIndex_ = 0; activeIndex_ < numActiveEvents_; ++activeIndex_) {
+      currentActiveChannel_ = poller_->activeChannel(activeIndex_);
+      if (slowCallbackUs_ > 0) {
+        const int fd = currentActiveChannel_->getFd();
+        const int64_t startUs = monotonicMicroseconds();
+        currentActiveChannel_->handleEvents();
+        const int64_t elapsedUs = monotonicMicroseconds() - startUs;
+        if (elapsedUs > slowCallbackUs_) {
+          LOG_WARN << "EventLoop slow event callback fd = " << fd << " took " << elapsedUs << "us";
+        }
+      } else {
+        currentActiveChannel_->handleEvents();
+      }
     }
     currentActiveChannel_ = NULL;
+    numActiveEvents_ = 0;
     eventHandling_ = false;
+    poller_->runCompletions();
+    const int64_t eventsDoneUs = monotonicMicroseconds();
+    stats_.handleEventsUs.record(eventsDoneUs - pollReturnUs);
     doPendingFunctors();
-    poller_->handleExpired();
+    const int64_t functorsDoneUs = monotonicMicroseconds();
+    stats_.pendingFunctorsUs.record(functorsDoneUs - eventsDoneUs);
+    timerManager_->handleExpiredEvent();
+    const int64_t timersDoneUs = monotonicMicroseconds();
+    stats_.expiredTimersUs.record(timersDoneUs - functorsDoneUs);
+
+    const int64_t latency = loopLatencyUs_.load(std::memory_order_relaxed);
+    const int64_t sample = timersDoneUs - pollReturnUs;
+    loopLatencyUs_.store(latency + ((sample - latency) >> kLatencyEwmaShift),
+                         std::memory_order_relaxed);
   }
   looping_ = false;
 }
@@ -94,20 +190,57 @@ void EventLoop::runInLoop(Functor&& cb) {
 }
 
 void EventLoop::queueInLoop(Functor&& cb) {
-  {
-    MutexLockGuard lock(mutex_);
-    pendingFunctors_.push_back(cb);
-  }
-
-  if (!isInLoopThread() || callingPendingFunctors_) {
+  pendingFunctors_.push(std::move(cb));
+  std::atomic_thread_fence(std::memory_order_seq_cst);
+  // 只有 Loop 可能在睡眠且还没有人唤醒时才写 eventfd
+  if (!wakeupPending_.load(std::memory_order_relaxed) &&
+      !wakeupPending_.exchange(true, std::memory_order_relaxed)) {
     wakeup();
   }
 }
 
+bool EventLoop::enableAcceptCompletion(int listenFd) {
+  assertInLoopThread();
+  return poller_->enableAcceptCompletion(listenFd);
+}
+
+bool EventLoop::takeAccepted(int listenFd, std::vector<int>* connfds) {
+  assertInLoopThread();
+  return poller_->takeAccepted(listenFd, connfds);
+}
+
+bool EventLoop::enableRecvCompletion(int fd) {
+  assertInLoopThread();
+  return poller_->enableRecvCompletion(fd);
+}
+
+bool EventLoop::takeReceived(int fd, Buffer* buf, ssize_t* n, int* savedErrno) {
+  assertInLoopThread();
+  return poller_->takeReceived(fd, buf, n, savedErrno);
+}
+
+bool EventLoop::canSubmitSend() const { return poller_->canSubmitSend(); }
+
+bool EventLoop::submitSend(int fd, const struct msghdr* msg, int flags, SendCallback&& cb) {
+  assertInLoopThread();
+  return poller_->submitSend(fd, msg, flags, std::move(cb));
+}
+
 void EventLoop::updateChannel(Channel* channel) {
   assertInLoopThread();
   assert(channel->getLoop() == this);
-  poller_->updateChannel(channel);
+  if (channel->getPendingIndex() < 0) {
+    channel->setPendingIndex(static_cast<int>(pendingUpdates_.size()));
+    pendingUpdates_.push_back(channel);
+  }
+}
+
+void EventLoop::applyChannelUpdates() {
+  for (Channel* channel : pendingUpdates_) {
+    channel->setPendingIndex(-1);
+    poller_->updateChannel(channel);
+  }
+  pendingUpdates_.clear();
 }
 
 void EventLoop::removeChannel(Channel* channel) {
@@ -116,8 +249,16 @@ void EventLoop::removeChannel(Channel* channel) {
   if (eventHandling_) {
     // 确保删除的不是未处理的 channel，或者是当前通道正在处理的是 close
     assert(currentActiveChannel_ == channel ||
-           std::find(activeChannels_.begin(), activeChannels_.end(), channel) ==
-               activeChannels_.end());
+           !poller_->hasPendingEvent(channel, activeIndex_ + 1, numActiveEvents_));
+  }
+  const int index = channel->getPendingIndex();
+  if (index >= 0) {
+    // 从待提交列表中摘掉，末尾元素补位
+    Channel* last = pendingUpdates_.back();
+    pendingUpdates_[index] = last;
+    last->setPendingIndex(index);
+    pendingUpdates_.pop_back();
+    channel->setPendingIndex(-1);
   }
   poller_->removeChannel(channel);
 }
@@ -139,22 +280,153 @@ void EventLoop::wakeup()
 }
 
 void EventLoop::doPendingFunctors() {
-  std::vector<Functor> functors;
-  callingPendingFunctors_ = true;
+  // 只执行本轮开始时已在队列中的任务，任务里再入队的留到下一轮
+  size_t n = pendingFunctors_.size();
+  stats_.queueLength.record(n);
+  Functor functor;
+  while (n-- > 0 && pendingFunctors_.pop(&functor)) {
+    if (slowCallbackUs_ > 0) {
+      const int64_t startUs = monotonicMicroseconds();
+      functor();
+      const int64_t elapsedUs = monotonicMicroseconds() - startUs;
+      if (elapsedUs > slowCallbackUs_) {
+        LOG_WARN << "EventLoop slow pending functor took " << elapsedUs << "us";
+      }
+    } else {
+      functor();
+    }
+  }
+  functor = Functor();
+}
+
+void EventLoop::addConnection(const HttpServerPtr& conn) {
+  assertInLoopThread();
+  assert(conn->getLoop() == this);
+  const size_t fd = static_cast<size_t>(conn->getFd());
+  if (fd >= connections_.size()) {
+    connections_.resize(fd + 1);
+  }
+  assert(!connections_[fd]);
+  connections_[fd] = conn;
+  numConnections_.store(numConnections_.load(std::memory_order_relaxed) + 1,
+                        std::memory_order_relaxed);
+}
+
+void EventLoop::removeConnection(const HttpServerPtr& conn) {
+  assertInLoopThread();
+  const size_t fd = static_cast<size_t>(conn->getFd());
+  if (fd < connections_.size() && connections_[fd] == conn) {
+    connections_[fd].reset();
+    numConnections_.store(numConnections_.load(std::memory_order_relaxed) - 1,
+                          std::memory_order_relaxed);
+  }
+}
+
+void EventLoop::addTimer(TimerNode* node, int timeout) {
+  assertInLoopThread();
+  timerManager_->addTimer(node, timeout);
+}
+
+void EventLoop::cancelTimer(TimerNode* node) {
+  assertInLoopThread();
+  timerManager_->cancelTimer(node);
+}
+
+int EventLoop::timerRemaining(const TimerNode* node) const {
+  return timerManager_->remaining(node);
+}
+
+TimerId EventLoop::runAt(int64_t whenMs, Functor&& cb) {
+  const int64_t delayMs = whenMs - monotonicMilliseconds();
+  return startTimer(static_cast<int>(std::min<int64_t>(std::max<int64_t>(delayMs, 0), INT_MAX)),
+                    0, std::move(cb));
+}
+
+TimerId EventLoop::runAfter(int delayMs, Functor&& cb) {
+  return startTimer(delayMs, 0, std::move(cb));
+}
+
+TimerId EventLoop::runEvery(int intervalMs, Functor&& cb) {
+  assert(intervalMs > 0);
+  return startTimer(intervalMs, intervalMs, std::move(cb));
+}
 
+void EventLoop::cancel(TimerId timerId) {
+  if (!timerId.valid()) return;
+  runInLoop([this, timerId] { cancelInLoop(timerId); });
+}
+
+TimerId EventLoop::startTimer(int delayMs, int intervalMs, Functor&& cb) {
+  LoopTimer* timer;
   {
-    MutexLockGuard lock(mutex_);
-    functors.swap(pendingFunctors_);
+    MutexLockGuard lock(timerMutex_);
+    timer = freeTimers_;
+    if (timer) {
+      freeTimers_ = timer->nextFree;
+    } else {
+      timers_.emplace_back(new LoopTimer);
+      timer = timers_.back().get();
+      timer->node.setCallback(std::bind(&EventLoop::handleTimer, this, timer));
+    }
+  }
+  // 从空闲链表取下后只有当前线程持有，交给 Loop 之前可以直接填写
+  timer->callback = std::move(cb);
+  timer->intervalMs = intervalMs;
+  timer->state = LoopTimer::kPending;
+  TimerId timerId(timer, timer->sequence);
+  runInLoop([this, timer, delayMs] { scheduleInLoop(timer, delayMs); });
+  return timerId;
+}
+
+void EventLoop::scheduleInLoop(LoopTimer* timer, int delayMs) {
+  assertInLoopThread();
+  if (timer->state == LoopTimer::kCancelled) {
+    // 还没挂上时间轮就被取消了
+    releaseTimer(timer);
+    return;
   }
+  timer->state = LoopTimer::kArmed;
+  timerManager_->addTimer(&timer->node, delayMs);
+}
 
-  for (const Functor& functor : functors) {
-    functor();
+void EventLoop::cancelInLoop(TimerId timerId) {
+  assertInLoopThread();
+  LoopTimer* timer = timerId.timer_;
+  if (timer->sequence != timerId.sequence_) return;
+  switch (timer->state) {
+    case LoopTimer::kArmed:
+      timerManager_->cancelTimer(&timer->node);
+      releaseTimer(timer);
+      break;
+    case LoopTimer::kPending:
+    case LoopTimer::kRunning:
+      // 等 scheduleInLoop 或回调返回后再回收
+      timer->state = LoopTimer::kCancelled;
+      break;
+    default:
+      break;
+  }
+}
+
+void EventLoop::handleTimer(LoopTimer* timer) {
+  timer->state = LoopTimer::kRunning;
+  timer->callback();
+  if (timer->state == LoopTimer::kCancelled || timer->intervalMs == 0) {
+    releaseTimer(timer);
+  } else {
+    timer->state = LoopTimer::kArmed;
+    timerManager_->addTimer(&timer->node, timer->intervalMs);
   }
-  callingPendingFunctors_ = false;
 }
 
-void EventLoop::add_timer(Channel* channel, int timeout) {
-  poller_->add_timer(channel, timeout);
+void EventLoop::releaseTimer(LoopTimer* timer) {
+  // 回调里捕获的对象在 Loop 线程中析构
+  timer->callback = nullptr;
+  timer->state = LoopTimer::kFree;
+  ++timer->sequence;
+  MutexLockGuard lock(timerMutex_);
+  timer->nextFree = freeTimers_;
+  freeTimers_ = timer;
 }
 
 void EventLoop::handleRead() {
@@ -1,21 +1,37 @@
 #ifndef EVENTLOOP_H
 #define EVENTLOOP_H
 
+#include "LoopStats.h"
+#include "Timer.h"
 #include "base/CurrentThread.h"
+#include "base/InlineFunction.h"
+#include "base/MpscQueue.h"
 #include "base/Mutex.h"
 
 #include <assert.h>
+#include <sys/types.h>
+#include <atomic>
 #include <functional>
 #include <memory>
+#include <vector>
 
+class Buffer;
+class BufferPool;
 class Channel;
-class Epoll;
+class ConnectionPool;
+class HttpServer;
+class Poller;
+class TimerManager;
+class ZeroCopyLinger;
 
 using namespace std;
 
 class EventLoop {
  public:
-  typedef std::function<void()> Functor;
+  // 跨线程投递的任务，绑定的参数放在对象内部，入队不分配内存
+  typedef InlineFunction<void(), 64> Functor;
+  // 完成式发送的回调，参数为发出的字节数或 -errno
+  typedef InlineFunction<void(int), 48> SendCallback;
   EventLoop();
   ~EventLoop();
   void loop();
@@ -26,34 +42,111 @@ class EventLoop {
   bool isInLoopThread() const { return threadId_ == CurrentThread::tid(); }
   void assertInLoopThread() { assert(isInLoopThread()); }
 
+  // 兴趣事件的变化先记录下来，每轮 poll 之前统一提交
   void updateChannel(Channel*);
   void removeChannel(Channel*);
   bool hasChannel(Channel*);
-  void add_timer(Channel* channel, int timeout);
+  // 对象内嵌的定时器，timeout 毫秒后在 Loop 线程中触发，重复设置只会改期
+  void addTimer(TimerNode* node, int timeout);
+  void cancelTimer(TimerNode* node);
+  // 距离到期的毫秒数，没有设置返回 -1
+  int timerRemaining(const TimerNode* node) const;
+  // 通用定时器，任意线程可调用，回调在 Loop 线程中执行
+  // 定时器对象放在空闲链表里循环使用，稳定运行后不分配内存
+  // whenMs 是 monotonicMilliseconds() 的绝对时刻
+  TimerId runAt(int64_t whenMs, Functor&& cb);
+  TimerId runAfter(int delayMs, Functor&& cb);
+  TimerId runEvery(int intervalMs, Functor&& cb);
+  // 任意线程可调用，已经触发的一次性定时器或重复取消什么也不做
+  // 可以在回调里取消自己
+  void cancel(TimerId timerId);
+  // 只能在 Loop 线程中使用
+  BufferPool* bufferPool() { return bufferPool_.get(); }
+  // 连接对象的分配只能在 Loop 线程中进行，释放可以在任意线程
+  const std::shared_ptr<ConnectionPool>& connectionPool() const { return connectionPool_; }
+  // 关闭后还在等零拷贝完成通知的 socket，只能在 Loop 线程中使用
+  ZeroCopyLinger* zeroCopyLinger() { return zeroCopyLinger_.get(); }
+  // 完成式接受、接收和发送，转给 Poller，只有 io_uring 后端支持，见 Poller.h
+  bool enableAcceptCompletion(int listenFd);
+  bool takeAccepted(int listenFd, std::vector<int>* connfds);
+  bool enableRecvCompletion(int fd);
+  bool takeReceived(int fd, Buffer* buf, ssize_t* n, int* savedErrno);
+  bool canSubmitSend() const;
+  bool submitSend(int fd, const struct msghdr* msg, int flags, SendCallback&& cb);
+  // 自适应忙轮询：有事件后的 budgetUs 微秒内以 0 超时 poll，之后再阻塞等待
+  // 0 表示关闭，在 loop() 开始前设置
+  void setBusyPollBudget(int budgetUs) { busyPollBudgetUs_ = budgetUs; }
+  int busyPollBudget() const { return busyPollBudgetUs_; }
+
+  // 本 Loop 拥有的连接，以 fd 为下标，只能在 Loop 线程中访问；关闭时不必经过主 Loop
+  void addConnection(const std::shared_ptr<HttpServer>& conn);
+  void removeConnection(const std::shared_ptr<HttpServer>& conn);
+  const std::vector<std::shared_ptr<HttpServer>>& connections() const { return connections_; }
+
+  // 负载统计，任意线程可读，用于分配新连接
+  int numConnections() const { return numConnections_.load(std::memory_order_relaxed); }
+  // 已经交给本 Loop、还没建立的连接，交出的线程加一，Loop 线程建立时减一
+  int numIncomingConnections() const { return numIncomingConnections_.load(std::memory_order_relaxed); }
+  void incomingConnectionQueued() { numIncomingConnections_.fetch_add(1, std::memory_order_relaxed); }
+  void incomingConnectionTaken() { numIncomingConnections_.fetch_sub(1, std::memory_order_relaxed); }
+  size_t queueSize() const { return pendingFunctors_.size(); }
+  // 最近每轮处理（事件、任务、定时器）耗时的指数移动平均，微秒
+  int64_t loopLatencyUs() const { return loopLatencyUs_.load(std::memory_order_relaxed); }
+  // 每轮各阶段的直方图，任意线程可读
+  const LoopStats& stats() const { return stats_; }
+  // 单个事件回调或任务超过 thresholdUs 微秒时打日志，0 关闭，在 loop() 开始前设置
+  void setSlowCallbackThreshold(int thresholdUs) { slowCallbackUs_ = thresholdUs; }
 
  private:
   void wakeup();
   void handleRead();
   void doPendingFunctors();
-
-  typedef std::vector<Channel*> ChannelList;
+  void applyChannelUpdates();
+  TimerId startTimer(int delayMs, int intervalMs, Functor&& cb);
+  void scheduleInLoop(LoopTimer* timer, int delayMs);
+  void cancelInLoop(TimerId timerId);
+  void handleTimer(LoopTimer* timer);
+  void releaseTimer(LoopTimer* timer);
 
   bool looping_;
   bool quit_;
   bool eventHandling_;
-  bool callingPendingFunctors_;
   const pid_t threadId_;
-  std::unique_ptr<Epoll> poller_;
+  int busyPollBudgetUs_;
+  int slowCallbackUs_;
+  std::unique_ptr<Poller> poller_;
+  std::unique_ptr<TimerManager> timerManager_;
+  std::unique_ptr<BufferPool> bufferPool_;
+  std::shared_ptr<ConnectionPool> connectionPool_;
 
   int wakeupFd_;
   std::unique_ptr<Channel> wakeupChannel_;
+  std::unique_ptr<ZeroCopyLinger> zeroCopyLinger_;
 
-  ChannelList activeChannels_;
+  int numActiveEvents_;
+  int activeIndex_;
   Channel* currentActiveChannel_;
+  std::vector<Channel*> pendingUpdates_;
 
-  mutable MutexLock mutex_;
   // 其他线程线程对当前 Loop 的线程安全调用任务队列
-  std::vector<Functor> pendingFunctors_;
+  MpscQueue<Functor> pendingFunctors_;
+  // Loop 醒着或已经有人写过 eventfd 时为 true，生产者不必再写
+  std::atomic<bool> wakeupPending_;
+
+  std::vector<std::shared_ptr<HttpServer>> connections_;
+  // 只有 Loop 线程写
+  std::atomic<int> numConnections_;
+  // 交出连接的线程和 Loop 线程都会写
+  std::atomic<int> numIncomingConnections_;
+  // 只有 Loop 线程写
+  std::atomic<int64_t> loopLatencyUs_;
+  LoopStats stats_;
+
+  // 保护空闲链表和 timers_，取用定时器对象可能在其他线程
+  MutexLock timerMutex_;
+  LoopTimer* freeTimers_;
+  // 所有定时器对象，随 Loop 一起释放，句柄里的指针一直有效
+  std::vector<std::unique_ptr<LoopTimer>> timers_;
 };
 
 #endif
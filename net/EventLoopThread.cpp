@@ -1,13 +1,16 @@
 #include "EventLoopThread.h"
 
 EventLoopThread::EventLoopThread(const ThreadInitCallback& cb,
-                                 const string& name)
+                                 const string& name, int cpu)
     : loop_(NULL),
       exiting_(false),
       thread_(bind(&EventLoopThread::threadFunc, this), name),
       mutex_(),
       cond_(mutex_),
-      callback_(cb) {}
+      callback_(cb) {
+  // EventLoop 及其 BufferPool 都在线程函数里创建，绑核后分配在本地 NUMA 节点
+  thread_.setCpuAffinity(cpu);
+}
 
 EventLoopThread::~EventLoopThread() {
   exiting_ = true;
@@ -10,9 +10,11 @@ class EventLoopThread : noncopyable {
   typedef std::function<void(EventLoop*)> ThreadInitCallback;
 
   EventLoopThread(const ThreadInitCallback& cb = ThreadInitCallback(),
-                  const string& name = string());
+                  const string& name = string(), int cpu = -1);
   ~EventLoopThread();
   EventLoop* startLoop();
+  // startLoop() 之后有效
+  pid_t tid() const { return thread_.tid(); }
 
  private:
   void threadFunc();
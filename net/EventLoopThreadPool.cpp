@@ -1,4 +1,7 @@
 #include "EventLoopThreadPool.h"
+#include "base/Logging.h"
+
+#include <sched.h>
 
 EventLoopThreadPool::EventLoopThreadPool(EventLoop* baseLoop,
                                          const string& name,
@@ -7,7 +10,8 @@ EventLoopThreadPool::EventLoopThreadPool(EventLoop* baseLoop,
       name_(name),
       started_(false),
       numThreads_(numThreads),
-      next_(0) {
+      randState_(0x9e3779b9),
+      pinThreads_(false) {
   assert(numThreads_ >= 0);
 }
 
@@ -18,27 +22,79 @@ void EventLoopThreadPool::start(const ThreadInitCallback& cb) {
   // assertInLoopThread 保证只能由主线程调用
   baseLoop_->assertInLoopThread();
   started_ = true;
+  std::vector<int> cpus;
+  if (pinThreads_) {
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    if (sched_getaffinity(0, sizeof(set), &set) == 0) {
+      for (int cpu = 0; cpu < CPU_SETSIZE; ++cpu) {
+        if (CPU_ISSET(cpu, &set)) cpus.push_back(cpu);
+      }
+    } else {
+      LOG_SYSERR << "EventLoopThreadPool::start sched_getaffinity";
+    }
+    if (!cpus.empty() && numThreads_ > static_cast<int>(cpus.size())) {
+      LOG_WARN << "EventLoopThreadPool::start " << numThreads_
+               << " threads share " << cpus.size() << " cpus";
+    }
+  }
   for (int i = 0; i < numThreads_; ++i) {
     char buf[name_.size() + 32];
     snprintf(buf, sizeof(buf), "%s%d", name_.c_str(), i);
-    EventLoopThread* t = new EventLoopThread(cb, buf);
+    int cpu = cpus.empty() ? -1 : cpus[i % cpus.size()];
+    EventLoopThread* t = new EventLoopThread(cb, buf, cpu);
     threads_.push_back(std::unique_ptr<EventLoopThread>(t));
     loops_.push_back(t->startLoop());
+    // 线程比 CPU 多时同一 CPU 上有多个 Loop，只记第一个；绑核失败的不记，按 CPU 分流时不会选到它
+    if (cpu >= 0 && pinnedTo(t->tid(), cpu)) {
+      if (static_cast<size_t>(cpu) >= cpuLoops_.size()) cpuLoops_.resize(cpu + 1, NULL);
+      if (cpuLoops_[cpu] == NULL) cpuLoops_[cpu] = loops_.back();
+    }
   }
   if (numThreads_ == 0 && cb) {
     cb(baseLoop_);
   }
 }
 
+// 线程实际的亲和性是否只有这个 CPU
+bool EventLoopThreadPool::pinnedTo(pid_t tid, int cpu) {
+  cpu_set_t set;
+  CPU_ZERO(&set);
+  if (sched_getaffinity(tid, sizeof(set), &set) != 0) {
+    LOG_SYSERR << "EventLoopThreadPool::start sched_getaffinity";
+    return false;
+  }
+  if (CPU_COUNT(&set) != 1 || !CPU_ISSET(cpu, &set)) {
+    LOG_WARN << "EventLoopThreadPool::start thread " << tid << " is not pinned to cpu " << cpu;
+    return false;
+  }
+  return true;
+}
+
 EventLoop* EventLoopThreadPool::getNextLoop() {
   baseLoop_->assertInLoopThread();
   assert(started_);
-  EventLoop* loop = baseLoop_;
-  if (!loops_.empty()) {
-    loop = loops_[next_];
-    next_ = (next_ + 1) % numThreads_;
-  }
-  return loop;
+  if (loops_.empty()) return baseLoop_;
+  if (loops_.size() == 1) return loops_[0];
+  // xorshift32，只在主线程使用
+  randState_ ^= randState_ << 13;
+  randState_ ^= randState_ >> 17;
+  randState_ ^= randState_ << 5;
+  const uint32_t n = static_cast<uint32_t>(loops_.size());
+  const uint32_t first = randState_ % n;
+  // 第二个在其余 n - 1 个中选，保证两者不同
+  const uint32_t second = (first + 1 + (randState_ >> 16) % (n - 1)) % n;
+  EventLoop* a = loops_[first];
+  EventLoop* b = loops_[second];
+  return loadOf(b) < loadOf(a) ? b : a;
+}
+
+// 负载以连接数（含已交出、还没建立的）为主，积压的跨线程任务和每轮耗时（每 100us 折合一个连接）作为补充
+// 这些统计来自其他线程，可能略有滞后，两选一对滞后信息不敏感
+int64_t EventLoopThreadPool::loadOf(const EventLoop* loop) {
+  return loop->numConnections() + loop->numIncomingConnections() +
+         static_cast<int64_t>(loop->queueSize()) +
+         loop->loopLatencyUs() / 100;
 }
 
 std::vector<EventLoop*> EventLoopThreadPool::getAllLoops() {
@@ -14,10 +14,17 @@ class EventLoopThreadPool : noncopyable {
   EventLoopThreadPool(EventLoop* baseLoop, const string& name, const int numThreads);
 
   ~EventLoopThreadPool();
+  // 在 start() 之前调用，第 i 个 I/O 线程绑定到进程可用 CPU 中的第 i 个
+  void setPinThreads(bool on) { pinThreads_ = on; }
   void start(const ThreadInitCallback& cb = ThreadInitCallback());
 
+  // 随机取两个 Loop，选负载较低的一个（power of two choices）
   EventLoop* getNextLoop();
   std::vector<EventLoop*> getAllLoops();
+  // 确实绑定在该 CPU 上的 Loop，没有则返回 NULL
+  EventLoop* getLoopForCpu(int cpu) const {
+    return cpu >= 0 && static_cast<size_t>(cpu) < cpuLoops_.size() ? cpuLoops_[cpu] : NULL;
+  }
 
   bool started() const { return started_; }
 
@@ -28,9 +35,15 @@ class EventLoopThreadPool : noncopyable {
   string name_;
   bool started_;
   int numThreads_;
-  int next_;
+  static int64_t loadOf(const EventLoop* loop);
+  static bool pinnedTo(pid_t tid, int cpu);
+
+  uint32_t randState_;
+  bool pinThreads_;
   std::vector<std::unique_ptr<EventLoopThread>> threads_;
   std::vector<EventLoop*> loops_;
+  // 以 CPU 编号为下标
+  std::vector<EventLoop*> cpuLoops_;
 };
 
 #endif
@@ -3,11 +3,12 @@
 #include "Channel.h"
 #include "EventLoop.h"
 #include "Util.h"
+#include "ZeroCopyLinger.h"
 #include "base/Logging.h"
-#include "Timer.h"
+#include "base/WorkStealingPool.h"
 
 #include <fcntl.h>
-#include <sys/mman.h>
+#include <atomic>
 #include <unistd.h>
 #include <sys/socket.h>
 #include <sys/stat.h>
@@ -18,9 +19,83 @@ pthread_once_t MimeType::once_control = PTHREAD_ONCE_INIT;
 std::unordered_map<std::string, std::string> MimeType::mime;
 
 const int DEFAULT_KEEP_ALIVE_TIME = 5 * 60 * 1000;  // ms
+// 空闲连接保留的输入缓冲区上限，超过则收缩
+const size_t kMaxIdleBufferSize = 4 * 1024;
 
 const string source = "./source";
 
+const OutputQueue::Blob kHelloBody = std::make_shared<const string>(
+    "<html><title>Hello</title><body bgcolor=\"ffffff\">Hello<hr>\n</body></html>");
+const OutputQueue::Blob kNotFoundBody = std::make_shared<const string>(
+    "<html><title>NotFound</title><body bgcolor=\"ffffff\">404 Not Found<hr>\n</body></html>");
+
+namespace {
+struct Route
+{
+  HttpServer::Handler handler;
+  bool cpuBound;
+};
+
+// 启动前注册，之后只读，各线程无需加锁
+std::unordered_map<string, Route> g_routes;
+WorkStealingPool* g_computePool = NULL;
+size_t g_zeroCopyThreshold = 0;
+size_t g_outputMemoryBudget = 0;
+// 所有连接输出队列占用的内存，各连接按变化量更新
+std::atomic<size_t> g_outputMemoryBytes(0);
+
+void writeResponseHead(Buffer* output, HttpStatusCode statusCode, const string& statusMessage,
+                       std::map<string, string>* headers, bool close, size_t contentLength)
+{
+  if (close)
+  {
+    (*headers)["Connection"] = "close";
+  }
+  else
+  {
+    (*headers)["Connection"] = "Keep-Alive";
+    (*headers)["Content-Length"] = std::to_string(contentLength);
+  }
+
+  char buf[32];
+  snprintf(buf, sizeof buf, "HTTP/1.1 %d ", statusCode);
+  output->append(buf);
+  output->append(statusMessage);
+  output->append("\r\n");
+
+  for (const auto& header : *headers)
+  {
+    output->append(header.first);
+    output->append(": ");
+    output->append(header.second);
+    output->append("\r\n");
+  }
+
+  output->append("\r\n");
+}
+}  // namespace
+
+void HttpServer::registerHandler(const string& path, const Handler& handler, bool cpuBound)
+{
+  Route route = {handler, cpuBound};
+  g_routes[path] = route;
+}
+
+void HttpServer::setComputePool(WorkStealingPool* pool)
+{
+  g_computePool = pool;
+}
+
+void HttpServer::setZeroCopyThreshold(size_t bytes)
+{
+  g_zeroCopyThreshold = bytes;
+}
+
+void HttpServer::setOutputMemoryBudget(size_t bytes)
+{
+  g_outputMemoryBudget = bytes;
+}
+
 void MimeType::init() {
   mime[".html"] = "text/html";
   mime[".avi"] = "video/x-msvideo";
@@ -49,16 +124,32 @@ std::string MimeType::getMime(const std::string &suffix) {
 HttpServer::HttpServer(EventLoop *loop, int connfd)
     : loop_(CHECK_NOTNULL(loop)),
       connfd_(connfd),
-      channel_(new Channel(loop, connfd)),
+      channel_(loop, connfd),
+      inBuffer_(loop->bufferPool()),
+      outQueue_(loop->bufferPool()),
       connState_(kConnecting),
       requestParseState_(kExpectRequestLine),
       method_(kInvalid),
-      version_(kvUnknown) {
-  channel_->setReadHandler(bind(&HttpServer::handleRead, this));
-  channel_->setWriteHandler(bind(&HttpServer::handleWrite, this));
-  channel_->setCloseHandler(bind(&HttpServer::handleClose, this));
-  channel_->setErrorHandler(std::bind(&HttpServer::handleError, this));
+      version_(kvUnknown),
+      computing_(false),
+      readPaused_(false),
+      asyncSend_(loop->canSubmitSend()),
+      flushQueued_(false),
+      pendingInputQueued_(false),
+      recvCompletion_(false),
+      highWaterMark_(0),
+      lowWaterMark_(0),
+      accountedOutputBytes_(0) {
+  channel_.setReadHandler(bind(&HttpServer::handleRead, this));
+  channel_.setWriteHandler(bind(&HttpServer::handleWrite, this));
+  channel_.setCloseHandler(bind(&HttpServer::handleClose, this));
+  channel_.setErrorHandler(std::bind(&HttpServer::handleError, this));
+  timer_.setCallback(std::bind(&HttpServer::handleTimeout, this));
   setKeepAlive(connfd, true);
+  if (loop->busyPollBudget() > 0)
+  {
+    setBusyPoll(connfd, loop->busyPollBudget());
+  }
 }
 
 HttpServer::~HttpServer()
@@ -75,17 +166,13 @@ void HttpServer::reset()
   query_.clear();
   headers_.clear();
   body_.clear();
-  seperateTimer();
+  // 请求处理完进入 keep-alive 空闲，从现在开始计时，到期回收连接
+  loop_->addTimer(&timer_, DEFAULT_KEEP_ALIVE_TIME);
 }
 
 void HttpServer::seperateTimer()
 {
-  if (timer_.lock())
-  {
-    shared_ptr<TimerNode> my_timer(timer_.lock());
-    my_timer->clear();
-    timer_.reset();
-  }
+  loop_->cancelTimer(&timer_);
 }
 
 void HttpServer::send(const std::string_view& message)
@@ -129,6 +216,24 @@ void HttpServer::send(Buffer* buf)
   }
 }
 
+void HttpServer::sendBlob(const OutputQueue::Blob& blob)
+{
+  if (connState_ == kConnected)
+  {
+    loop_->runInLoop(
+        std::bind(&HttpServer::sendBlobInLoop, shared_from_this(), blob));
+  }
+}
+
+void HttpServer::sendFile(const SharedFilePtr& file, off_t offset, size_t len)
+{
+  if (connState_ == kConnected)
+  {
+    loop_->runInLoop(
+        std::bind(&HttpServer::sendFileInLoop, shared_from_this(), file, offset, len));
+  }
+}
+
 void HttpServer::sendInLoop(const void* data, size_t len)
 {
   loop_->assertInLoopThread();
@@ -141,9 +246,9 @@ void HttpServer::sendInLoop(const void* data, size_t len)
     return;
   }
   // if no thing in output queue, try writing directly
-  if (!channel_->isWriting() && outBuffer_.readableBytes() == 0)
+  if (!asyncSend_ && !channel_.isWriting() && outQueue_.empty())
   {
-    nwrote = write(channel_->getFd(), data, len);
+    nwrote = write(channel_.getFd(), data, len);
     if (nwrote >= 0)
     {
       remaining = len - nwrote;
@@ -165,14 +270,254 @@ void HttpServer::sendInLoop(const void* data, size_t len)
   assert(remaining <= len);
   if (!faultError && remaining > 0)
   {
-    outBuffer_.append(static_cast<const char*>(data)+nwrote, remaining);
-    if (!channel_->isWriting())
+    outQueue_.append(static_cast<const char*>(data)+nwrote, remaining);
+    if (asyncSend_)
+    {
+      scheduleFlush();
+    }
+    else if (!channel_.isWriting())
+    {
+      channel_.enableWriting();
+    }
+    updateBackpressure();
+  }
+}
+
+void HttpServer::sendBlobInLoop(const OutputQueue::Blob& blob)
+{
+  loop_->assertInLoopThread();
+  if (connState_ == kDisconnected)
+  {
+    LOG_WARN << "disconnected, give up writing";
+    return;
+  }
+  appendBlobToQueue(blob);
+  outputAppended();
+}
+
+void HttpServer::appendBlobToQueue(const OutputQueue::Blob& blob)
+{
+  // 按响应大小决定：大的数据块省掉内核拷贝，小的不值得等完成通知
+  const bool zeroCopy = g_zeroCopyThreshold > 0 && blob->size() >= g_zeroCopyThreshold;
+  outQueue_.appendBlob(blob, 0, blob->size(), zeroCopy);
+}
+
+// 响应头和响应体一起进入输出队列再写一次：小响应头和体在同一个 writev 里，
+// 文件响应的头带 MSG_MORE 和 sendfile 的开头合成一个报文段
+void HttpServer::sendHeadAndBody(Buffer* head, const OutputQueue::Blob& blob, const SharedFilePtr& file)
+{
+  loop_->assertInLoopThread();
+  if (connState_ == kDisconnected)
+  {
+    LOG_WARN << "disconnected, give up writing";
+    return;
+  }
+  outQueue_.append(head->peek(), head->readableBytes());
+  head->retrieveAll();
+  if (blob)
+  {
+    appendBlobToQueue(blob);
+  }
+  else if (file)
+  {
+    outQueue_.appendFile(file, 0, file->size());
+  }
+  outputAppended();
+}
+
+void HttpServer::sendFileInLoop(const SharedFilePtr& file, off_t offset, size_t len)
+{
+  loop_->assertInLoopThread();
+  if (connState_ == kDisconnected)
+  {
+    LOG_WARN << "disconnected, give up writing";
+    return;
+  }
+  outQueue_.appendFile(file, offset, len);
+  outputAppended();
+}
+
+void HttpServer::outputAppended()
+{
+  if (asyncSend_)
+  {
+    scheduleFlush();
+  }
+  else if (!channel_.isWriting())
+  {
+    flushOutput();
+    return;
+  }
+  updateBackpressure();
+}
+
+// 本轮处理的请求产生的输出攒在一起，事件处理之后作为一个发送请求提交，
+// 所有连接的发送再和下一次等待合并成一次 io_uring_enter
+void HttpServer::scheduleFlush()
+{
+  if (flushQueued_ || channel_.isWriting() || outQueue_.asyncSendInFlight()) return;
+  flushQueued_ = true;
+  loop_->queueInLoop(std::bind(&HttpServer::queuedFlush, shared_from_this()));
+}
+
+void HttpServer::queuedFlush()
+{
+  flushQueued_ = false;
+  if (connState_ != kDisconnected)
+  {
+    flushOutput();
+  }
+}
+
+// 写出 outQueue_ 直到写完或 EAGAIN，边沿触发下 EPOLLOUT 保持开启直到写完
+// io_uring 下能异步发送的部分提交给内核，完成时再继续
+void HttpServer::flushOutput()
+{
+  if (outQueue_.asyncSendInFlight()) return;
+  if (asyncSend_ && startAsyncSend())
+  {
+    if (channel_.isWriting())
+    {
+      channel_.disableWriting();
+    }
+    updateBackpressure();
+    return;
+  }
+  int savedErrno = 0;
+  if (outQueue_.writeFd(connfd_, &savedErrno) < 0)
+  {
+    errno = savedErrno;
+    LOG_SYSERR << "HttpServer::flushOutput";
+    outQueue_.clear();
+  }
+  if (outQueue_.empty())
+  {
+    outQueue_.releaseStorage();
+    if (channel_.isWriting())
+    {
+      channel_.disableWriting();
+    }
+    if (connState_ == kDisconnecting)
+    {
+      shutDownInLoop();
+    }
+  }
+  else if (!channel_.isWriting())
+  {
+    channel_.enableWriting();
+  }
+  updateBackpressure();
+}
+
+bool HttpServer::startAsyncSend()
+{
+  int flags = 0;
+  const struct msghdr* msg = outQueue_.prepareAsyncSend(&flags);
+  if (msg == NULL)
+  {
+    return false;
+  }
+  // 回调持有本对象，在途期间连接即使关闭也不会释放 fd 和存储
+  return loop_->submitSend(connfd_, msg, flags,
+                           std::bind(&HttpServer::handleSendComplete, shared_from_this(),
+                                     std::placeholders::_1));
+}
+
+void HttpServer::handleSendComplete(int res)
+{
+  outQueue_.completeAsyncSend(res > 0 ? static_cast<size_t>(res) : 0);
+  if (connState_ == kDisconnected)
+  {
+    return;
+  }
+  loop_->addTimer(&timer_, DEFAULT_KEEP_ALIVE_TIME);
+  if (res == -EAGAIN)
+  {
+    // 内核没有替我们等可写，退回 EPOLLOUT
+    if (!channel_.isWriting())
+    {
+      channel_.enableWriting();
+    }
+    return;
+  }
+  if (res < 0)
+  {
+    errno = -res;
+    LOG_SYSERR << "HttpServer::handleSendComplete";
+    outQueue_.clear();
+  }
+  flushOutput();
+}
+
+// 输出积压时暂停读：不再读入和处理新的请求，客户端收不完响应就不会发来更多请求
+void HttpServer::updateBackpressure()
+{
+  const size_t memory = outQueue_.memoryBytes();
+  if (memory != accountedOutputBytes_)
+  {
+    // 无符号回绕，减少时同样正确
+    g_outputMemoryBytes.fetch_add(memory - accountedOutputBytes_, std::memory_order_relaxed);
+    accountedOutputBytes_ = memory;
+  }
+  const size_t queued = outQueue_.readableBytes();
+  // 超出全局预算时只暂停还有待发数据的连接，它们写完就会恢复，不会全部卡住
+  const bool overBudget = g_outputMemoryBudget > 0 && queued > 0 &&
+                          g_outputMemoryBytes.load(std::memory_order_relaxed) > g_outputMemoryBudget;
+  if (!readPaused_)
+  {
+    if ((highWaterMark_ > 0 && queued > highWaterMark_) || overBudget)
     {
-      channel_->enableWriting();
+      readPaused_ = true;
+      if (channel_.isReading())
+      {
+        channel_.disableReading();
+      }
+      if (highWaterMarkCallback_)
+      {
+        highWaterMarkCallback_(shared_from_this(), queued);
+      }
+    }
+  }
+  else if (queued <= lowWaterMark_ && !overBudget)
+  {
+    readPaused_ = false;
+    if (connState_ == kConnected)
+    {
+      channel_.enableReading();
+      // 暂停时 socket 没有读到 EAGAIN，而同一轮里的暂停/恢复在提交时会互相抵消，
+      // 不会重新注册，边沿也不会再报告，所以主动读一次
+      // 可能正处在 onMessage 中，留到任务阶段处理
+      if (!pendingInputQueued_)
+      {
+        pendingInputQueued_ = true;
+        loop_->queueInLoop(std::bind(&HttpServer::processPendingInput, shared_from_this()));
+      }
+    }
+    if (lowWaterMarkCallback_)
+    {
+      lowWaterMarkCallback_(shared_from_this(), queued);
     }
   }
 }
 
+// 先处理暂停期间留在 inBuffer_ 中的请求，再把 socket 读到 EAGAIN
+void HttpServer::processPendingInput()
+{
+  pendingInputQueued_ = false;
+  if (connState_ != kConnected || readPaused_)
+  {
+    return;
+  }
+  if (inBuffer_.readableBytes() > 0)
+  {
+    onMessage();
+  }
+  if (connState_ == kConnected && !readPaused_)
+  {
+    handleRead();
+  }
+}
+
 bool HttpServer::setMethod(const char* start, const char* end)
 {
   assert(method_ == kInvalid);
@@ -370,12 +715,14 @@ bool HttpServer::parseRequest()
   return ok;
 }
 
-bool HttpServer::analysisRequest(bool isclose, Buffer *output)
+bool HttpServer::analysisRequest(bool isclose, Buffer *output,
+                                 OutputQueue::Blob *blob, SharedFilePtr *file)
 {
   bool ok = true;
   std::map<string, string> headers;
   HttpStatusCode statusCode;
-  string statusMessage, body;
+  string statusMessage;
+  size_t contentLength = 0;
   if (method_ == kPut || method_ == kDelete)
   {
     statusCode = k200Ok;
@@ -389,7 +736,7 @@ bool HttpServer::analysisRequest(bool isclose, Buffer *output)
       statusCode = k200Ok;
       statusMessage = "OK";
       headers["Content-Type"] = "text/plain";
-      body = "<html><title>Hello</title><body bgcolor=\"ffffff\">Hello<hr>\n</body></html>";
+      *blob = kHelloBody;
     }
     else
     {
@@ -399,12 +746,15 @@ bool HttpServer::analysisRequest(bool isclose, Buffer *output)
         path_ = "/index.html";
       } 
       path_ = source + path_;
-      if (stat(path_.c_str(), &sbuf) < 0)
+      int src_fd = -1;
+      // 目录等非普通文件不能 sendfile，按不存在处理
+      if (stat(path_.c_str(), &sbuf) < 0 || !S_ISREG(sbuf.st_mode) ||
+          (method_ != kHead && (src_fd = open(path_.c_str(), O_RDONLY | O_CLOEXEC, 0)) < 0))
       {
         statusCode = k404NotFound;
         statusMessage = "Not Found";
         headers["Content-Type"] = "text/html";
-        body = "<html><title>NotFound</title><body bgcolor=\"ffffff\">404 Not Found<hr>\n</body></html>";
+        *blob = kNotFoundBody;
         ok = false;
       }
       else
@@ -418,81 +768,41 @@ bool HttpServer::analysisRequest(bool isclose, Buffer *output)
         else
           filetype = MimeType::getMime(path_.substr(pos));
         headers["Content-Type"] = filetype;
+        contentLength = sbuf.st_size;
 
-        if (method_ != kHead)
-        { 
-          int src_fd = open(path_.c_str(), O_RDONLY, 0);
-          if (src_fd < 0)
-          {
-            statusCode = k404NotFound;
-            statusMessage = "Not Found";
-            headers["Content-Type"] = "text/html";
-            body = "<html><title>NotFound</title><body bgcolor=\"ffffff\">404 Not Found<hr>\n</body></html>";
-            ok = false;
-          }
-          else
-          {
-            void *mmapRet = mmap(NULL, sbuf.st_size, PROT_READ, MAP_PRIVATE, src_fd, 0);
-            close(src_fd);
-            if (mmapRet == (void *)-1)
-            {
-              statusCode = k404NotFound;
-              statusMessage = "Not Found";
-              headers["Content-Type"] = "text/html";
-              body = "<html><title>NotFound</title><body bgcolor=\"ffffff\">404 Not Found<hr>\n</body></html>";
-              ok = false;
-            }
-            else
-            {
-              body = string(static_cast<char *>(mmapRet), sbuf.st_size);
-            }
-            munmap(mmapRet, sbuf.st_size);
-          }
+        // 文件内容不再读进内存，由 sendfile 直接发送
+        if (src_fd >= 0)
+        {
+          file->reset(new SharedFile(src_fd, sbuf.st_size));
         }
       }
     }
   }
 
-  if (isclose || !ok)
+  if (*blob)
   {
-    headers["Connection"] = "close";
-  }
-  else
-  {
-    headers["Connection"] = "Keep-Alive";
-    headers["Content-Length"] = body.size();
+    contentLength = (*blob)->size();
   }
 
-  char buf[32];
-  snprintf(buf, sizeof buf, "HTTP/1.1 %d ", statusCode);
-  output->append(buf);
-  output->append(statusMessage);
-  output->append("\r\n");
-
-  for (const auto& header : headers)
-  {
-    output->append(header.first);
-    output->append(": ");
-    output->append(header.second);
-    output->append("\r\n");
-  }
-
-  output->append("\r\n");
-  output->append(body);
-  
+  writeResponseHead(output, statusCode, statusMessage, &headers, isclose || !ok, contentLength);
   return ok;
 }
 
 void HttpServer::onMessage()
 {
-  if (!parseRequest())
-  {
-    send("HTTP/1.1 400 Bad Request\r\n\r\n");
-    shutDown();
-  }
-
-  if (requestParseState_ == kFinish)
+  // 处理缓冲区中所有完整的请求；转入计算线程池或输出积压时停下，之后再继续
+  while (!computing_ && !readPaused_ && connState_ == kConnected)
   {
+    if (!parseRequest())
+    {
+      send("HTTP/1.1 400 Bad Request\r\n\r\n");
+      shutDown();
+      break;
+    }
+    if (requestParseState_ != kFinish)
+    {
+      break;
+    }
     onRequest();
     reset();
   }
@@ -502,15 +812,101 @@ void HttpServer::onRequest()
 {
   const string& connection = getHeader("Connection");
   bool close = connection == "close" || (version_ == kHttp10 && connection != "Keep-Alive");
-  Buffer buf;
-  bool ok = analysisRequest(close, &buf);
-  send(&buf);
+  if (dispatchToHandler(close))
+  {
+    return;
+  }
+  Buffer buf(loop_->bufferPool());
+  OutputQueue::Blob blob;
+  SharedFilePtr file;
+  bool ok = analysisRequest(close, &buf, &blob, &file);
+  if (method_ == kHead)
+  {
+    blob.reset();
+    file.reset();
+  }
+  sendHeadAndBody(&buf, blob, file);
   if (close || !ok)
   {
     shutDown();
   }
 }
 
+// 没有注册处理函数时返回 false，由静态文件逻辑处理
+bool HttpServer::dispatchToHandler(bool close)
+{
+  if (method_ != kGet && method_ != kPost)
+  {
+    return false;
+  }
+  std::unordered_map<string, Route>::const_iterator it = g_routes.find(path_);
+  if (it == g_routes.end())
+  {
+    return false;
+  }
+  const Route& route = it->second;
+  std::shared_ptr<HttpRequest> request(new HttpRequest);
+  request->method = method_;
+  request->path.swap(path_);
+  request->query.swap(query_);
+  request->headers.swap(headers_);
+  request->body.swap(body_);
+  std::shared_ptr<HttpResponse> response(new HttpResponse);
+  if (!route.cpuBound || g_computePool == NULL)
+  {
+    route.handler(*request, response.get());
+    sendResponse(response, close);
+    return true;
+  }
+
+  // 计算期间连接不会迁移（不空闲），loop_ 不变
+  computing_ = true;
+  HttpServerPtr self(shared_from_this());
+  EventLoop* loop = loop_;
+  const Handler* handler = &route.handler;
+  g_computePool->submit([self, loop, handler, request, response, close] {
+    (*handler)(*request, response.get());
+    loop->queueInLoop(std::bind(&HttpServer::onComputeDone, self, response, close));
+  });
+  return true;
+}
+
+void HttpServer::onComputeDone(const std::shared_ptr<HttpResponse>& response, bool close)
+{
+  loop_->assertInLoopThread();
+  computing_ = false;
+  if (connState_ != kConnected)
+  {
+    return;
+  }
+  sendResponse(response, close);
+  // 计算期间到达的请求
+  if (connState_ == kConnected && inBuffer_.readableBytes() > 0)
+  {
+    onMessage();
+  }
+}
+
+void HttpServer::sendResponse(const std::shared_ptr<HttpResponse>& response, bool close)
+{
+  std::map<string, string> headers;
+  headers["Content-Type"] = response->contentType;
+  Buffer buf(loop_->bufferPool());
+  writeResponseHead(&buf, response->statusCode, response->statusMessage,
+                    &headers, close, response->body.size());
+  OutputQueue::Blob body;
+  if (!response->body.empty())
+  {
+    // 与 response 共享所有权，响应体不拷贝
+    body = OutputQueue::Blob(response, &response->body);
+  }
+  sendHeadAndBody(&buf, body, SharedFilePtr());
+  if (close)
+  {
+    shutDown();
+  }
+}
+
 void HttpServer::shutDown()
 {
   if (connState_ == kConnected)
@@ -523,7 +919,8 @@ void HttpServer::shutDown()
 void HttpServer::shutDownInLoop()
 {
   loop_->assertInLoopThread();
-  if (!channel_->isWriting())
+  // 还有输出（包括在途的异步发送）时等写完再关
+  if (!channel_.isWriting() && outQueue_.empty())
   {
     if (shutdown(connfd_, SHUT_WR) < 0)
     {
@@ -532,14 +929,21 @@ void HttpServer::shutDownInLoop()
   }
 }
 
-void HttpServer::connectEstablished()
+void HttpServer::connectEstablished(bool dataReady)
 {
   loop_->assertInLoopThread();
   assert(connState_ == kConnecting);
   connState_ = kConnected;
-  channel_->setTie(shared_from_this());
-  channel_->setET();
-  channel_->enableReading();
+  // 不用 tie：Channel 注册期间 Loop 的连接表一直持有本对象，关闭时的销毁任务也持有引用，
+  // 每个事件省去一次 weak_ptr::lock 的原子操作
+  recvCompletion_ = loop_->enableRecvCompletion(connfd_);
+  channel_.setET();
+  channel_.enableReading();
+  if (dataReady)
+  {
+    // 读到 EAGAIN 为止，之后注册时边沿已经消费，不会再多报一次
+    handleRead();
+  }
 }
 
 void HttpServer::connectDestroyed()
@@ -548,22 +952,91 @@ void HttpServer::connectDestroyed()
   if (connState_ == kConnected)
   {
     connState_ = kDisconnected;
-    channel_->disableAll();
+    channel_.disableAll();
 
   }
-  channel_->remove();
+  channel_.remove();
   seperateTimer();
+  if (outQueue_.hasZeroCopyPending())
+  {
+    outQueue_.handleZeroCopyCompletions(connfd_);
+    // 内核可能还在发送或重传这些数据块，不能随连接一起释放
+    if (outQueue_.hasZeroCopyPending())
+    {
+      loop_->zeroCopyLinger()->add(connfd_, outQueue_.takeZeroCopyPins());
+    }
+  }
+  // 存储归还给 Loop 的内存池
+  inBuffer_.releaseStorage();
+  outQueue_.releaseStorage();
+  g_outputMemoryBytes.fetch_sub(accountedOutputBytes_, std::memory_order_relaxed);
+  accountedOutputBytes_ = 0;
+}
+
+bool HttpServer::isIdle() const
+{
+  return connState_ == kConnected && requestParseState_ == kExpectRequestLine && !computing_ &&
+         inBuffer_.readableBytes() == 0 && outQueue_.empty() && !channel_.isWriting() &&
+         !outQueue_.hasZeroCopyPending() && !flushQueued_ && !pendingInputQueued_;
+}
+
+bool HttpServer::migrateTo(EventLoop* target)
+{
+  loop_->assertInLoopThread();
+  // multishot recv 在原 Loop 的缓冲区环里随时可能收到数据，不能交给别的 Loop
+  if (target == loop_ || recvCompletion_ || !isIdle())
+  {
+    return false;
+  }
+  int timeout = loop_->timerRemaining(&timer_);
+  if (timeout < 0)
+  {
+    timeout = DEFAULT_KEEP_ALIVE_TIME;
+  }
+  seperateTimer();
+  channel_.disableAll();
+  channel_.remove();
+  // 缓冲区是空的，存储还给原 Loop 的内存池，之后从新 Loop 的池分配
+  inBuffer_.resetPool(target->bufferPool());
+  outQueue_.resetPool(target->bufferPool());
+  HttpServerPtr self(shared_from_this());
+  loop_->removeConnection(self);
+  // 之后只有 target 线程访问本连接，经由任务队列交接
+  loop_ = target;
+  channel_.setLoop(target);
+  target->queueInLoop(std::bind(&HttpServer::attachInLoop, self, timeout));
+  return true;
+}
+
+void HttpServer::attachInLoop(int timeout)
+{
+  loop_->assertInLoopThread();
+  loop_->addConnection(shared_from_this());
+  if (loop_->busyPollBudget() > 0)
+  {
+    setBusyPoll(connfd_, loop_->busyPollBudget());
+  }
+  // 迁移期间到达的数据在重新注册时会立即报告
+  recvCompletion_ = loop_->enableRecvCompletion(connfd_);
+  channel_.setET();
+  channel_.enableReading();
+  loop_->addTimer(&timer_, timeout);
 }
 
 void HttpServer::handleRead()
 {
   loop_->assertInLoopThread();
-  loop_->add_timer(channel_.get(), DEFAULT_KEEP_ALIVE_TIME);
+  loop_->addTimer(&timer_, DEFAULT_KEEP_ALIVE_TIME);
   int saveErrno = 0;
   ssize_t n;
-  while((n = inBuffer_.readFd(connfd_, &saveErrno)) > 0)
+  while((n = readInput(&saveErrno)) > 0)
   {
     onMessage();
+    if (readPaused_)
+    {
+      // socket 里剩下的数据由恢复时的 processPendingInput 读取
+      return;
+    }
   }
   if (n == 0)
   {
@@ -577,43 +1050,50 @@ void HttpServer::handleRead()
       LOG_SYSERR << "HttpServer::handleRead";
       handleError();
     }
-  }
-}
-
-void HttpServer::handleWrite()
-{
-  loop_->assertInLoopThread();
-  loop_->add_timer(channel_.get(), DEFAULT_KEEP_ALIVE_TIME);
-  if (channel_->isWriting())
-  {
-    channel_->disableWriting();
-    ssize_t n = write(connfd_,
-                      outBuffer_.peek(),
-                      outBuffer_.readableBytes());
-    if (n > 0)
+    else
     {
-      outBuffer_.retrieve(n);
-      if (outBuffer_.readableBytes() == 0)
+      // 读空后连接进入空闲，不再占用输入缓冲区
+      if (inBuffer_.readableBytes() == 0)
       {
-        if (connState_ == kDisconnecting)
-        {
-          shutDownInLoop();
-        }
+        inBuffer_.releaseStorage();
       }
-      else
+      else if (inBuffer_.internalCapacity() > kMaxIdleBufferSize)
       {
-        channel_->enableWriting();
+        inBuffer_.shrink(0);
       }
     }
-    else
-    {
-      LOG_SYSERR << "HttpServer::handleWrite";
-    }
+  }
+}
+
+ssize_t HttpServer::readInput(int* savedErrno)
+{
+  ssize_t n;
+  // 内核已经收进缓冲区环的数据追加到 inBuffer_，缓冲区随即归还
+  if (recvCompletion_ && loop_->takeReceived(connfd_, &inBuffer_, &n, savedErrno))
+  {
+    return n;
+  }
+  return inBuffer_.readFd(connfd_, savedErrno);
+}
+
+void HttpServer::handleWrite()
+{
+  loop_->assertInLoopThread();
+  loop_->addTimer(&timer_, DEFAULT_KEEP_ALIVE_TIME);
+  if (channel_.isWriting())
+  {
+    flushOutput();
   }
 }
 
 void HttpServer::handleError()
 {
+  // 零拷贝发送的完成通知放在错误队列里，同样以 EPOLLERR 报告
+  const bool zeroCopyPending = outQueue_.hasZeroCopyPending();
+  if (zeroCopyPending)
+  {
+    outQueue_.handleZeroCopyCompletions(connfd_);
+  }
   int optval;
   socklen_t optlen = static_cast<socklen_t>(sizeof optval);
   int err;
@@ -625,15 +1105,26 @@ void HttpServer::handleError()
   {
     err = optval;
   }
+  if (err == 0 && zeroCopyPending)
+  {
+    return;
+  }
   LOG_ERROR << "HttpServer::handleError - SO_ERROR = " << err << " " << strerror_tl(err);
 }
 
+void HttpServer::handleTimeout()
+{
+  // 连接表持有本对象，关闭回调里会移除，先保住自己
+  HttpServerPtr guardThis(shared_from_this());
+  handleClose();
+}
+
 void HttpServer::handleClose()
 {
   loop_->assertInLoopThread();
   assert(connState_ == kConnected || connState_ == kDisconnecting);
   connState_ = kDisconnected;
-  channel_->disableAll();
+  channel_.disableAll();
   seperateTimer();
   HttpServerPtr guardThis(shared_from_this());
   // must be the last line
@@ -2,9 +2,15 @@
 #define HTTPSERVER_H
 
 #include "Buffer.h"
+#include "Channel.h"
+#include "OutputQueue.h"
+#include "Timer.h"
+#include "base/InlineFunction.h"
 
-#include <memory>
+#include <functional>
 #include <map>
+#include <memory>
+#include <unordered_map>
 
 enum HttpRequestParseState
 {
@@ -43,8 +49,25 @@ class MimeType {
 };
 
 class EventLoop;
-class Channel;
-class TimerNode;
+class WorkStealingPool;
+
+struct HttpRequest
+{
+  HttpMethod method;
+  std::string path;
+  std::string query;
+  std::map<std::string, std::string> headers;
+  std::string body;
+};
+
+struct HttpResponse
+{
+  HttpResponse() : statusCode(k200Ok), statusMessage("OK"), contentType("text/plain") {}
+  HttpStatusCode statusCode;
+  std::string statusMessage;
+  std::string contentType;
+  std::string body;
+};
 
 
 class HttpServer : public std::enable_shared_from_this<HttpServer> {
@@ -52,25 +75,51 @@ class HttpServer : public std::enable_shared_from_this<HttpServer> {
   static const size_t kCheapPrepend = 8;
   static const size_t kInitialSize = 1024;
   typedef std::shared_ptr<HttpServer> HttpServerPtr;
-  typedef std::function<void (const HttpServerPtr&)> CloseCallback;
+  typedef InlineFunction<void (const HttpServerPtr&), 32> CloseCallback;
+  // 第二个参数是当时输出队列的长度
+  typedef InlineFunction<void (const HttpServerPtr&, size_t), 32> WaterMarkCallback;
+  typedef std::function<void (const HttpRequest&, HttpResponse*)> Handler;
+
+  // 在 Server 启动前注册，按路径精确匹配 GET/POST 请求
+  // cpuBound 的处理函数在计算线程池中运行，响应再投递回连接所在的 Loop；它不能访问连接
+  static void registerHandler(const std::string& path, const Handler& handler, bool cpuBound = false);
+  // 在 Server 启动前设置，NULL 时 cpuBound 的处理函数也在 I/O 线程中运行
+  static void setComputePool(WorkStealingPool* pool);
+  // 在 Server 启动前设置，不小于 bytes 的数据块响应用 MSG_ZEROCOPY 发送，0 关闭
+  static void setZeroCopyThreshold(size_t bytes);
+  // 在 Server 启动前设置，所有连接输出队列占用内存的总预算，超出后有待发数据的连接都暂停读，0 关闭
+  static void setOutputMemoryBudget(size_t bytes);
+
   HttpServer(EventLoop *loop, int connfd);
   ~HttpServer();
   void reset();
   int getFd() { return connfd_; }
-  void setCloseCallback(const CloseCallback& cb) { closeCallback_ = cb; }
+  void setCloseCallback(CloseCallback&& cb) { closeCallback_ = std::move(cb); }
+  // 输出队列超过 high 字节时暂停读（不再处理新的请求），回落到 low 字节以下时恢复；high 为 0 关闭
+  void setWaterMarks(size_t high, size_t low) {
+    highWaterMark_ = high;
+    lowWaterMark_ = low;
+  }
+  void setHighWaterMarkCallback(WaterMarkCallback&& cb) { highWaterMarkCallback_ = std::move(cb); }
+  void setLowWaterMarkCallback(WaterMarkCallback&& cb) { lowWaterMarkCallback_ = std::move(cb); }
   void seperateTimer();
-  void timeoutClose() { handleClose(); }
-  void linkTimer(std::shared_ptr<TimerNode> mtimer) { seperateTimer(); timer_ = mtimer; }
   EventLoop *getLoop() { return loop_; }
   bool setMethod(const char* start, const char* end);
   void addHeader(const char* start, const char* colon, const char* end);
   std::string getHeader(const std::string& field) const;
 
-  void connectEstablished();
+  // dataReady 为 true 时立即读一次，不等下一轮 poll 报告可读
+  void connectEstablished(bool dataReady = false);
   void connectDestroyed();
+  // 在当前 Loop 中调用，连接空闲（两个请求之间）时连同 Channel、缓冲区和定时器一起迁到 target
+  // 不空闲（包括还有零拷贝数据块等待内核释放）时放弃并返回 false
+  bool migrateTo(EventLoop* target);
 
   void send(const std::string_view& message);
   void send(Buffer* message);
+  // 不拷贝，数据块/文件在发送完之前一直被引用
+  void sendBlob(const OutputQueue::Blob& blob);
+  void sendFile(const SharedFilePtr& file, off_t offset, size_t len);
 
   void shutDown();
   void shutDownInLoop();
@@ -78,9 +127,10 @@ class HttpServer : public std::enable_shared_from_this<HttpServer> {
  private:
   EventLoop *loop_;
   int connfd_;
-  std::unique_ptr<Channel> channel_;
+  // 与连接一起从池中分配
+  Channel channel_;
   Buffer inBuffer_;
-  Buffer outBuffer_;
+  OutputQueue outQueue_;
   
   HttpMethod method_;
   HttpVersion version_;
@@ -90,20 +140,58 @@ class HttpServer : public std::enable_shared_from_this<HttpServer> {
   std::string body_;
   HttpRequestParseState requestParseState_;
   ConnectionState connState_;
-  std::weak_ptr<TimerNode> timer_;
+  // 空闲超时，重新设置不分配内存
+  TimerNode timer_;
   CloseCallback closeCallback_;
+  // 有请求在计算线程池中处理，期间收到的数据先留在 inBuffer_，保证响应顺序
+  bool computing_;
+  // 输出积压而暂停读，期间已读入的请求也先不处理
+  bool readPaused_;
+  // io_uring 后端下输出作为 SENDMSG 请求提交，随 poll 批量进入内核
+  const bool asyncSend_;
+  // 本轮的输出已经安排在事件处理之后提交
+  bool flushQueued_;
+  // 恢复读之后的 processPendingInput 已经排进任务队列，运行前不能迁移
+  bool pendingInputQueued_;
+  // io_uring 后端下由 multishot recv 收数据，读就绪时从 Loop 的缓冲区环取走
+  bool recvCompletion_;
+  size_t highWaterMark_;
+  size_t lowWaterMark_;
+  // 已经计入全局输出内存的字节数
+  size_t accountedOutputBytes_;
+  WaterMarkCallback highWaterMarkCallback_;
+  WaterMarkCallback lowWaterMarkCallback_;
 
   void handleRead();
+  ssize_t readInput(int* savedErrno);
   void handleWrite();
   void handleClose();
   void handleError();
+  void handleTimeout();
   void onMessage();
   void onRequest();
   void sendInLoop(const void* message, size_t len);
-  
+  void sendBlobInLoop(const OutputQueue::Blob& blob);
+  void sendFileInLoop(const SharedFilePtr& file, off_t offset, size_t len);
+  void appendBlobToQueue(const OutputQueue::Blob& blob);
+  void sendHeadAndBody(Buffer* head, const OutputQueue::Blob& blob, const SharedFilePtr& file);
+  void outputAppended();
+  void scheduleFlush();
+  void queuedFlush();
+  void flushOutput();
+  bool startAsyncSend();
+  void handleSendComplete(int res);
+  void updateBackpressure();
+  void processPendingInput();
+  bool isIdle() const;
+  bool dispatchToHandler(bool close);
+  void onComputeDone(const std::shared_ptr<HttpResponse>& response, bool close);
+  void sendResponse(const std::shared_ptr<HttpResponse>& response, bool close);
+  void attachInLoop(int timeout);
+
   bool parseRequest();
   bool parseRequestLine(const char* begin, const char* end);
-  bool analysisRequest(bool close, Buffer *output);
+  bool analysisRequest(bool close, Buffer *output, OutputQueue::Blob *blob, SharedFilePtr *file);
 };
 
 typedef std::shared_ptr<HttpServer> HttpServerPtr;
@@ -0,0 +1,582 @@
+#include "IoUring.h"
+#include "Buffer.h"
+#include "base/Logging.h"
+
+#include <errno.h>
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <algorithm>
+#include <cstring>
+
+namespace {
+// user_data 的高 32 位为代数，低 32 位中最高两位为请求类型，其余为 fd 或发送槽位
+enum RequestKind { kPollRequest = 0, kAcceptRequest = 1, kSendRequest = 2, kRecvRequest = 3 };
+const uint32_t kIndexMask = (1U << 30) - 1;
+// POLL_REMOVE / ASYNC_CANCEL 自身的完成事件不需要处理，先于类型判断，不会和 recv 请求混淆
+const uint64_t kIgnoreData = ~0ULL;
+const uint16_t kBufferGroup = 0;
+// recv 模式下由 recv 完成事件报告的部分：数据、对端关闭
+const uint32_t kRecvEvents = EPOLLIN | EPOLLPRI | EPOLLRDHUP | EPOLLHUP;
+
+uint64_t makeUserData(RequestKind kind, uint32_t index, uint32_t generation) {
+  return (static_cast<uint64_t>(generation) << 32) | (static_cast<uint32_t>(kind) << 30) | index;
+}
+}  // namespace
+
+const unsigned IoUring::kRingEntries;
+const unsigned IoUring::kRecvBufferCount;
+const unsigned IoUring::kRecvBufferSize;
+
+IoUring::IoUring(EventLoop* loop)
+    : Poller(loop),
+      ringFd_(-1),
+      sqRing_(MAP_FAILED),
+      sqRingSize_(0),
+      cqRing_(MAP_FAILED),
+      cqRingSize_(0),
+      sqes_(static_cast<struct io_uring_sqe*>(MAP_FAILED)),
+      sqesSize_(0),
+      sqHead_(NULL),
+      sqTail_(NULL),
+      sqMask_(0),
+      sqEntries_(0),
+      sqLocalTail_(0),
+      cqHead_(NULL),
+      cqTail_(NULL),
+      cqMask_(0),
+      cqes_(NULL),
+      recvSupported_(false),
+      bufRing_(NULL),
+      bufRingSize_(0),
+      recvBuffers_(NULL),
+      bufRingTail_(0),
+      freeBuffers_(0) {
+  struct io_uring_params params;
+  memset(&params, 0, sizeof(params));
+  params.flags = IORING_SETUP_CQSIZE;
+  params.cq_entries = kRingEntries * 4;
+  int fd = static_cast<int>(syscall(__NR_io_uring_setup, kRingEntries, &params));
+  if (fd < 0) {
+    LOG_SYSERR << "io_uring_setup";
+    return;
+  }
+  if (!(params.features & IORING_FEAT_EXT_ARG)) {
+    LOG_ERROR << "io_uring lacks IORING_FEAT_EXT_ARG";
+    close(fd);
+    return;
+  }
+
+  sqRingSize_ = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+  cqRingSize_ = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+  const bool singleMmap = params.features & IORING_FEAT_SINGLE_MMAP;
+  if (singleMmap) {
+    sqRingSize_ = cqRingSize_ = std::max(sqRingSize_, cqRingSize_);
+  }
+  sqRing_ = mmap(NULL, sqRingSize_, PROT_READ | PROT_WRITE,
+                 MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+  if (sqRing_ != MAP_FAILED) {
+    cqRing_ = singleMmap ? sqRing_
+                         : mmap(NULL, cqRingSize_, PROT_READ | PROT_WRITE,
+                                MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_CQ_RING);
+  }
+  sqesSize_ = params.sq_entries * sizeof(struct io_uring_sqe);
+  if (cqRing_ != MAP_FAILED) {
+    sqes_ = static_cast<struct io_uring_sqe*>(
+        mmap(NULL, sqesSize_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+             fd, IORING_OFF_SQES));
+  }
+  if (sqes_ == MAP_FAILED) {
+    LOG_SYSERR << "io_uring mmap";
+    unmapRings();
+    close(fd);
+    return;
+  }
+
+  char* sq = static_cast<char*>(sqRing_);
+  sqHead_ = reinterpret_cast<unsigned*>(sq + params.sq_off.head);
+  sqTail_ = reinterpret_cast<unsigned*>(sq + params.sq_off.tail);
+  sqMask_ = *reinterpret_cast<unsigned*>(sq + params.sq_off.ring_mask);
+  sqEntries_ = params.sq_entries;
+  sqLocalTail_ = *sqTail_;
+  // SQ 索引数组固定为恒等映射
+  unsigned* sqArray = reinterpret_cast<unsigned*>(sq + params.sq_off.array);
+  for (unsigned i = 0; i < sqEntries_; ++i) sqArray[i] = i;
+
+  char* cq = static_cast<char*>(cqRing_);
+  cqHead_ = reinterpret_cast<unsigned*>(cq + params.cq_off.head);
+  cqTail_ = reinterpret_cast<unsigned*>(cq + params.cq_off.tail);
+  cqMask_ = *reinterpret_cast<unsigned*>(cq + params.cq_off.ring_mask);
+  cqes_ = reinterpret_cast<struct io_uring_cqe*>(cq + params.cq_off.cqes);
+
+  ringFd_ = fd;
+  setupBufferRing();
+}
+
+IoUring::~IoUring() {
+  if (ringFd_ >= 0) {
+    unmapRings();
+    close(ringFd_);
+  }
+  if (bufRing_ != NULL) munmap(bufRing_, bufRingSize_);
+  if (recvBuffers_ != NULL) munmap(recvBuffers_, kRecvBufferCount * kRecvBufferSize);
+}
+
+void IoUring::setupBufferRing() {
+#ifdef IORING_RECV_MULTISHOT
+  bufRingSize_ = kRecvBufferCount * sizeof(struct io_uring_buf);
+  void* ring = mmap(NULL, bufRingSize_, PROT_READ | PROT_WRITE,
+                    MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  void* buffers = mmap(NULL, kRecvBufferCount * kRecvBufferSize, PROT_READ | PROT_WRITE,
+                       MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (ring == MAP_FAILED || buffers == MAP_FAILED) {
+    LOG_SYSERR << "io_uring buffer ring mmap";
+    if (ring != MAP_FAILED) munmap(ring, bufRingSize_);
+    if (buffers != MAP_FAILED) munmap(buffers, kRecvBufferCount * kRecvBufferSize);
+    return;
+  }
+  struct io_uring_buf_reg reg;
+  memset(&reg, 0, sizeof(reg));
+  reg.ring_addr = reinterpret_cast<uint64_t>(ring);
+  reg.ring_entries = kRecvBufferCount;
+  reg.bgid = kBufferGroup;
+  if (syscall(__NR_io_uring_register, ringFd_, IORING_REGISTER_PBUF_RING, &reg, 1) < 0) {
+    // 内核太旧，连接照常用就绪通知加 read
+    LOG_WARN << "io_uring buffer ring unsupported, reads stay readiness-based";
+    munmap(ring, bufRingSize_);
+    munmap(buffers, kRecvBufferCount * kRecvBufferSize);
+    return;
+  }
+  bufRing_ = static_cast<struct io_uring_buf_ring*>(ring);
+  recvBuffers_ = static_cast<char*>(buffers);
+  for (unsigned i = 0; i < kRecvBufferCount; ++i) {
+    recycleBuffer(static_cast<uint16_t>(i));
+  }
+  recvSupported_ = true;
+#endif
+}
+
+void IoUring::recycleBuffer(uint16_t bid) {
+  // 环的条目从头开始排，尾部和第一个条目的保留字段重叠
+  // 不用头文件里的 bufs：C++ 下 __DECLARE_FLEX_ARRAY 前面的空结构体占位，偏移成了 8
+  struct io_uring_buf* buf = reinterpret_cast<struct io_uring_buf*>(bufRing_) +
+                             (bufRingTail_ & (kRecvBufferCount - 1));
+  buf->addr = reinterpret_cast<uint64_t>(recvBuffer(bid));
+  buf->len = kRecvBufferSize;
+  buf->bid = bid;
+  ++bufRingTail_;
+  // 内核看到新的尾部之前条目必须写好
+  __atomic_store_n(&bufRing_->tail, bufRingTail_, __ATOMIC_RELEASE);
+  ++freeBuffers_;
+}
+
+void IoUring::unmapRings() {
+  if (sqes_ != MAP_FAILED) munmap(sqes_, sqesSize_);
+  if (cqRing_ != MAP_FAILED && cqRing_ != sqRing_) munmap(cqRing_, cqRingSize_);
+  if (sqRing_ != MAP_FAILED) munmap(sqRing_, sqRingSize_);
+}
+
+int IoUring::enter(unsigned toSubmit, unsigned minComplete, unsigned flags,
+                   const void* arg, size_t argSize) {
+  return static_cast<int>(syscall(__NR_io_uring_enter, ringFd_, toSubmit,
+                                  minComplete, flags, arg, argSize));
+}
+
+struct io_uring_sqe* IoUring::getSqe() {
+  unsigned head = __atomic_load_n(sqHead_, __ATOMIC_ACQUIRE);
+  if (sqLocalTail_ - head >= sqEntries_) {
+    // SQ 满了，先提交一批
+    if (enter(sqLocalTail_ - head, 0, 0, NULL, 0) < 0) {
+      LOG_SYSFATAL << "io_uring_enter submit";
+    }
+    head = __atomic_load_n(sqHead_, __ATOMIC_ACQUIRE);
+    assert(sqLocalTail_ - head < sqEntries_);
+  }
+  struct io_uring_sqe* sqe = &sqes_[sqLocalTail_ & sqMask_];
+  memset(sqe, 0, sizeof(*sqe));
+  ++sqLocalTail_;
+  __atomic_store_n(sqTail_, sqLocalTail_, __ATOMIC_RELEASE);
+  return sqe;
+}
+
+void IoUring::armPoll(int fd, uint32_t events) {
+  struct io_uring_sqe* sqe = getSqe();
+  sqe->opcode = IORING_OP_POLL_ADD;
+  sqe->fd = fd;
+  // multishot poll 总是边沿触发，水平触发的 channel（eventfd）处理时会读空，不受影响
+  sqe->poll32_events = events & ~EPOLLET;
+  sqe->len = IORING_POLL_ADD_MULTI;
+  sqe->user_data = makeUserData(kPollRequest, fd, ++generations_[fd]);
+}
+
+void IoUring::armAccept(int fd) {
+#ifdef IORING_ACCEPT_MULTISHOT
+  struct io_uring_sqe* sqe = getSqe();
+  sqe->opcode = IORING_OP_ACCEPT;
+  sqe->fd = fd;
+  // 不取对端地址，multishot 请求只有一个地址缓冲区
+  sqe->accept_flags = SOCK_NONBLOCK | SOCK_CLOEXEC;
+  sqe->ioprio = IORING_ACCEPT_MULTISHOT;
+  sqe->user_data = makeUserData(kAcceptRequest, fd, ++generations_[fd]);
+#endif
+}
+
+void IoUring::armRecv(int fd) {
+#ifdef IORING_RECV_MULTISHOT
+  RecvQueue& queue = recvQueues_[fd];
+  struct io_uring_sqe* sqe = getSqe();
+  sqe->opcode = IORING_OP_RECV;
+  sqe->fd = fd;
+  // 不给缓冲区，由内核从缓冲区组里挑
+  sqe->flags = IOSQE_BUFFER_SELECT;
+  sqe->buf_group = kBufferGroup;
+  sqe->ioprio = IORING_RECV_MULTISHOT;
+  sqe->user_data = makeUserData(kRecvRequest, fd, queue.generation);
+  queue.armed = true;
+#endif
+}
+
+void IoUring::cancelRecv(int fd) {
+  RecvQueue& queue = recvQueues_[fd];
+  struct io_uring_sqe* sqe = getSqe();
+  sqe->opcode = IORING_OP_ASYNC_CANCEL;
+  sqe->addr = makeUserData(kRecvRequest, fd, queue.generation);
+  sqe->fd = -1;
+  sqe->user_data = kIgnoreData;
+  ++queue.generation;
+  queue.armed = false;
+}
+
+uint32_t IoUring::pollEvents(int fd, uint32_t events) const {
+  return recvEnabled(fd) ? events & ~kRecvEvents : events;
+}
+
+void IoUring::cancelRequest(int fd) {
+  struct io_uring_sqe* sqe = getSqe();
+  auto it = acceptQueues_.find(fd);
+  if (it != acceptQueues_.end() && it->second.multishot) {
+    sqe->opcode = IORING_OP_ASYNC_CANCEL;
+    sqe->addr = makeUserData(kAcceptRequest, fd, generations_[fd]);
+  } else {
+    sqe->opcode = IORING_OP_POLL_REMOVE;
+    sqe->addr = makeUserData(kPollRequest, fd, generations_[fd]);
+  }
+  sqe->fd = -1;
+  sqe->user_data = kIgnoreData;
+  // 旧请求在取消前可能已经产生的完成事件都会被丢弃
+  ++generations_[fd];
+}
+
+void IoUring::update(int operation, Channel* channel) {
+  const int fd = channel->getFd();
+  if (static_cast<size_t>(fd) >= generations_.size()) {
+    generations_.resize(channels_.size(), 0);
+    activeSlots_.resize(channels_.size(), 0);
+  }
+  // 监听 fd 只关心读，挂 multishot accept 代替 poll
+  auto accept = acceptQueues_.find(fd);
+  const bool multishotAccept = accept != acceptQueues_.end() && accept->second.multishot;
+  const uint32_t events = channel->getEvents();
+  switch (operation)
+  {
+  case EPOLL_CTL_ADD:
+    multishotAccept ? armAccept(fd) : armPoll(fd, pollEvents(fd, events));
+    if (recvEnabled(fd) && (events & EPOLLIN)) armRecv(fd);
+    break;
+  case EPOLL_CTL_MOD:
+    cancelRequest(fd);
+    multishotAccept ? armAccept(fd) : armPoll(fd, pollEvents(fd, events));
+    if (recvEnabled(fd)) {
+      // 只有读兴趣变化时才动 recv 请求，在途的数据不会因为开关写而被打断
+      RecvQueue& queue = recvQueues_[fd];
+      if ((events & EPOLLIN) && !queue.armed && !queue.eof && queue.error == 0) {
+        armRecv(fd);
+      } else if (!(events & EPOLLIN) && queue.armed) {
+        cancelRecv(fd);
+      }
+    }
+    break;
+  case EPOLL_CTL_DEL:
+    cancelRequest(fd);
+    if (recvEnabled(fd)) {
+      // 还没取走的数据没人要了，之后到达的旧完成事件只归还缓冲区
+      RecvQueue& queue = recvQueues_[fd];
+      if (queue.armed) cancelRecv(fd);
+      for (const RecvChunk& chunk : queue.chunks) recycleBuffer(chunk.bid);
+      queue.chunks.clear();
+      queue.enabled = false;
+    }
+    if (accept != acceptQueues_.end()) {
+      // 还没被取走的连接没人处理了
+      for (int connfd : accept->second.connfds) {
+        if (connfd >= 0) close(connfd);
+      }
+      accept->second.connfds.clear();
+    }
+    break;
+  default:
+    assert(false && "ERROR operation");
+    break;
+  }
+}
+
+void IoUring::addActiveEvent(int fd, uint32_t revents) {
+  int& slot = activeSlots_[fd];
+  if (slot == 0) {
+    ActiveEvent event = {channels_[fd].channel, revents};
+    activeEvents_.push_back(event);
+    slot = static_cast<int>(activeEvents_.size());
+  } else {
+    activeEvents_[slot - 1].revents |= revents;
+  }
+}
+
+void IoUring::handleCompletion(const struct io_uring_cqe* cqe) {
+  if (cqe->user_data == kIgnoreData) return;
+  const uint32_t low = static_cast<uint32_t>(cqe->user_data & 0xffffffff);
+  const RequestKind kind = static_cast<RequestKind>(low >> 30);
+  if (kind == kSendRequest) {
+    SendCompletion done = {low & kIndexMask, cqe->res};
+    completedSends_.push_back(done);
+    return;
+  }
+  const int fd = static_cast<int>(low & kIndexMask);
+  const uint32_t generation = static_cast<uint32_t>(cqe->user_data >> 32);
+  if (kind == kRecvRequest) {
+    handleRecvCompletion(fd, generation, cqe);
+    return;
+  }
+  if (static_cast<size_t>(fd) >= generations_.size() ||
+      generations_[fd] != generation || channels_[fd].channel == NULL) {
+    // 已经取消或重新挂过的旧请求，取消前接受的连接没人要了
+    if (kind == kAcceptRequest && cqe->res >= 0) close(cqe->res);
+    return;
+  }
+  if (kind == kAcceptRequest) {
+    handleAcceptCompletion(fd, cqe);
+    return;
+  }
+
+  if (cqe->res < 0) {
+    errno = -cqe->res;
+    LOG_SYSERR << "io_uring poll fd =" << fd;
+    return;
+  }
+  // recv 模式下对端关闭由 recv 报告，避免先于还没取走的数据处理关闭
+  const uint32_t revents = pollEvents(fd, static_cast<uint32_t>(cqe->res));
+  if (revents != 0) addActiveEvent(fd, revents);
+
+  if (!(cqe->flags & IORING_CQE_F_MORE) && channels_[fd].events != 0) {
+    // multishot 请求被内核终止（例如 CQ 溢出），重新挂上
+    armPoll(fd, pollEvents(fd, channels_[fd].events));
+  }
+}
+
+void IoUring::handleRecvCompletion(int fd, uint32_t generation, const struct io_uring_cqe* cqe) {
+  const bool hasBuffer = cqe->flags & IORING_CQE_F_BUFFER;
+  const uint16_t bid = static_cast<uint16_t>(cqe->flags >> IORING_CQE_BUFFER_SHIFT);
+  if (hasBuffer) --freeBuffers_;
+  if (!recvEnabled(fd)) {
+    // channel 已经删除
+    if (hasBuffer) recycleBuffer(bid);
+    return;
+  }
+  RecvQueue& queue = recvQueues_[fd];
+  if (static_cast<int32_t>(generation - queue.firstGeneration) < 0) {
+    // fd 已经被新连接复用，这是旧连接的请求
+    if (hasBuffer) recycleBuffer(bid);
+    return;
+  }
+  if (cqe->res > 0) {
+    // 数据已经从 socket 取出，即使请求已被取消（关读时）也属于这个连接
+    RecvChunk chunk = {bid, static_cast<uint32_t>(cqe->res)};
+    queue.chunks.push_back(chunk);
+    queue.received = true;
+    addActiveEvent(fd, EPOLLIN);
+  } else if (hasBuffer) {
+    recycleBuffer(bid);
+  }
+  if (generation != queue.generation || (cqe->flags & IORING_CQE_F_MORE)) return;
+
+  // 当前的 recv 请求结束了
+  queue.armed = false;
+  if (cqe->res == 0) {
+    queue.eof = true;
+    addActiveEvent(fd, EPOLLIN);
+  } else if (cqe->res == -ENOBUFS) {
+    // 缓冲区用完，等连接取走数据归还后在 runCompletions 里重新挂上
+    recvRearms_.push_back(fd);
+  } else if (cqe->res == -EINVAL && !queue.received) {
+    // 内核不支持 multishot recv，之后的连接都退回 poll 加 read
+    LOG_WARN << "io_uring multishot recv unsupported on fd " << fd << ", falling back to poll";
+    recvSupported_ = false;
+    queue.enabled = false;
+    cancelRequest(fd);
+    armPoll(fd, channels_[fd].events);
+    addActiveEvent(fd, EPOLLIN);
+  } else if (cqe->res < 0 && cqe->res != -ECANCELED) {
+    queue.error = -cqe->res;
+    addActiveEvent(fd, EPOLLIN);
+  } else if (cqe->res > 0 && (channels_[fd].events & EPOLLIN)) {
+    // CQ 溢出等原因被内核终止，重新挂上
+    armRecv(fd);
+  }
+}
+
+void IoUring::handleAcceptCompletion(int fd, const struct io_uring_cqe* cqe) {
+  AcceptQueue& queue = acceptQueues_[fd];
+  if (cqe->res == -EINVAL && !queue.accepted) {
+    // 内核不支持 multishot accept，退回 poll，本轮让 Acceptor 自己 accept4
+    LOG_WARN << "io_uring multishot accept unsupported on fd " << fd << ", falling back to poll";
+    queue.multishot = false;
+    armPoll(fd, channels_[fd].events);
+    addActiveEvent(fd, EPOLLIN);
+    return;
+  }
+  if (cqe->res >= 0) queue.accepted = true;
+  queue.connfds.push_back(cqe->res);
+  addActiveEvent(fd, EPOLLIN);
+  if (!(cqe->flags & IORING_CQE_F_MORE) && channels_[fd].events != 0) {
+    // 出错（如 EMFILE）或 CQ 溢出时内核终止了请求，重新挂上
+    armAccept(fd);
+  }
+}
+
+bool IoUring::enableAcceptCompletion(int listenFd) {
+#ifdef IORING_ACCEPT_MULTISHOT
+  AcceptQueue& queue = acceptQueues_[listenFd];
+  queue.multishot = true;
+  queue.accepted = false;
+  return true;
+#else
+  return false;
+#endif
+}
+
+bool IoUring::takeAccepted(int listenFd, std::vector<int>* connfds) {
+  auto it = acceptQueues_.find(listenFd);
+  if (it == acceptQueues_.end()) return false;
+  connfds->swap(it->second.connfds);
+  it->second.connfds.clear();
+  return it->second.multishot;
+}
+
+bool IoUring::submitSend(int fd, const struct msghdr* msg, int flags,
+                         EventLoop::SendCallback&& cb) {
+  uint32_t slot;
+  if (!freeSendSlots_.empty()) {
+    slot = freeSendSlots_.back();
+    freeSendSlots_.pop_back();
+    sendCallbacks_[slot] = std::move(cb);
+  } else {
+    slot = static_cast<uint32_t>(sendCallbacks_.size());
+    assert(slot <= kIndexMask);
+    sendCallbacks_.push_back(std::move(cb));
+  }
+  struct io_uring_sqe* sqe = getSqe();
+  sqe->opcode = IORING_OP_SENDMSG;
+  sqe->fd = fd;
+  sqe->addr = reinterpret_cast<uint64_t>(msg);
+  sqe->len = 1;
+  sqe->msg_flags = static_cast<uint32_t>(flags);
+  sqe->user_data = makeUserData(kSendRequest, slot, 0);
+  return true;
+}
+
+bool IoUring::enableRecvCompletion(int fd) {
+  if (!recvSupported_) return false;
+  if (static_cast<size_t>(fd) >= recvQueues_.size()) recvQueues_.resize(fd + 1);
+  RecvQueue& queue = recvQueues_[fd];
+  assert(!queue.enabled && queue.chunks.empty());
+  queue.enabled = true;
+  queue.armed = false;
+  queue.received = false;
+  queue.eof = false;
+  queue.error = 0;
+  queue.firstGeneration = ++queue.generation;
+  return true;
+}
+
+bool IoUring::takeReceived(int fd, Buffer* buf, ssize_t* n, int* savedErrno) {
+  if (!recvEnabled(fd)) return false;
+  RecvQueue& queue = recvQueues_[fd];
+  size_t total = 0;
+  for (const RecvChunk& chunk : queue.chunks) {
+    buf->append(recvBuffer(chunk.bid), chunk.len);
+    recycleBuffer(chunk.bid);
+    total += chunk.len;
+  }
+  queue.chunks.clear();
+  if (total > 0) {
+    *n = static_cast<ssize_t>(total);
+  } else if (queue.eof) {
+    *n = 0;
+  } else {
+    *n = -1;
+    *savedErrno = queue.error != 0 ? queue.error : EAGAIN;
+  }
+  return true;
+}
+
+void IoUring::runCompletions() {
+  if (!recvRearms_.empty() && freeBuffers_ > 0) {
+    for (int fd : recvRearms_) {
+      // 等待期间可能已经关闭、关读或被新的连接复用（那时注册时已经挂上）
+      if (recvEnabled(fd) && !recvQueues_[fd].armed && (channels_[fd].events & EPOLLIN)) {
+        armRecv(fd);
+      }
+    }
+    recvRearms_.clear();
+  }
+  for (size_t i = 0; i < completedSends_.size(); ++i) {
+    const SendCompletion done = completedSends_[i];
+    // 回调里可能提交新的发送并复用这个槽位
+    EventLoop::SendCallback cb(std::move(sendCallbacks_[done.slot]));
+    freeSendSlots_.push_back(done.slot);
+    cb(done.res);
+  }
+  completedSends_.clear();
+}
+
+int IoUring::poll(int timeout) {
+  assertInLoopThread();
+  activeEvents_.clear();
+
+  struct __kernel_timespec ts;
+  struct io_uring_getevents_arg arg;
+  memset(&arg, 0, sizeof(arg));
+  if (timeout >= 0) {
+    ts.tv_sec = timeout / 1000;
+    ts.tv_nsec = (timeout % 1000) * 1000000LL;
+    arg.ts = reinterpret_cast<uint64_t>(&ts);
+  }
+  // 提交本轮积累的所有 SQE，同时等待至少一个完成事件
+  unsigned toSubmit = sqLocalTail_ - __atomic_load_n(sqHead_, __ATOMIC_ACQUIRE);
+  if (enter(toSubmit, 1, IORING_ENTER_GETEVENTS | IORING_ENTER_EXT_ARG,
+            &arg, sizeof(arg)) < 0) {
+    if (errno != EINTR && errno != ETIME && errno != EBUSY) {
+      LOG_SYSERR << "IoUring::poll()";
+    }
+  }
+
+  unsigned head = *cqHead_;
+  unsigned tail = __atomic_load_n(cqTail_, __ATOMIC_ACQUIRE);
+  for (; head != tail; ++head) {
+    handleCompletion(&cqes_[head & cqMask_]);
+  }
+  __atomic_store_n(cqHead_, head, __ATOMIC_RELEASE);
+
+  for (const ActiveEvent& event : activeEvents_) {
+    activeSlots_[event.channel->getFd()] = 0;
+  }
+  return static_cast<int>(activeEvents_.size());
+}
+
+bool IoUring::hasPendingEvent(Channel* channel, int from, int numEvents) const {
+  for (int i = from; i < numEvents; ++i) {
+    if (activeEvents_[i].channel == channel) return true;
+  }
+  return false;
+}
@@ -0,0 +1,144 @@
+#ifndef IOURING_H
+#define IOURING_H
+
+#include <unordered_map>
+#include <vector>
+
+#include "Poller.h"
+
+struct io_uring_sqe;
+struct io_uring_cqe;
+struct io_uring_buf_ring;
+
+// io_uring 后端：每个 channel 挂一个 multishot poll 请求
+// 监听 fd 改挂 multishot accept，连接由内核直接接受；发送可以作为 SENDMSG 请求提交
+// 连接的读可以改挂 multishot recv，数据由内核直接收进 Loop 的缓冲区环（provided buffer ring）
+// 一轮中所有兴趣变化和发送产生的 SQE 与等待合并在一次 io_uring_enter 里完成
+class IoUring : public Poller {
+ public:
+  explicit IoUring(EventLoop* loop);
+  ~IoUring() override;
+
+  // 内核不支持或 ring 建立失败时返回 false
+  bool valid() const { return ringFd_ >= 0; }
+
+  int poll(int timeout) override;
+  Channel* activeChannel(int i) override {
+    Channel* channel = activeEvents_[i].channel;
+    channel->setRevents(activeEvents_[i].revents);
+    return channel;
+  }
+  bool hasPendingEvent(Channel* channel, int from, int numEvents) const override;
+
+  bool enableAcceptCompletion(int listenFd) override;
+  bool takeAccepted(int listenFd, std::vector<int>* connfds) override;
+  bool canSubmitSend() const override { return true; }
+  bool submitSend(int fd, const struct msghdr* msg, int flags,
+                  EventLoop::SendCallback&& cb) override;
+  bool enableRecvCompletion(int fd) override;
+  bool takeReceived(int fd, Buffer* buf, ssize_t* n, int* savedErrno) override;
+  void runCompletions() override;
+
+ private:
+  struct ActiveEvent {
+    Channel* channel;
+    uint32_t revents;
+  };
+  struct AcceptQueue {
+    bool multishot;  // false：内核不支持 multishot accept，已经退回 poll
+    bool accepted;   // 成功接受过连接
+    std::vector<int> connfds;
+  };
+  struct SendCompletion {
+    uint32_t slot;
+    int res;
+  };
+  struct RecvChunk {
+    uint16_t bid;
+    uint32_t len;
+  };
+  struct RecvQueue {
+    bool enabled;        // 连接的读由 multishot recv 完成，channel 删除时关闭
+    bool armed;          // recv 请求挂在内核里
+    bool received;       // 收到过数据
+    bool eof;
+    int error;
+    uint32_t generation; // recv 请求自己的代数，兴趣里去掉读时取消
+    uint32_t firstGeneration;  // 本连接的第一个代数，之前的是复用同一 fd 的旧连接
+    std::vector<RecvChunk> chunks;  // 已收到、还没被连接取走的缓冲区
+  };
+
+  void update(int operation, Channel* channel) override;
+  void armPoll(int fd, uint32_t events);
+  void armAccept(int fd);
+  void cancelRequest(int fd);
+  void armRecv(int fd);
+  void cancelRecv(int fd);
+  // recv 模式下 poll 只等读以外的事件，EPOLLERR 仍然由 poll 报告（零拷贝完成通知）
+  uint32_t pollEvents(int fd, uint32_t events) const;
+  bool recvEnabled(int fd) const {
+    return static_cast<size_t>(fd) < recvQueues_.size() && recvQueues_[fd].enabled;
+  }
+  void addActiveEvent(int fd, uint32_t revents);
+  void handleAcceptCompletion(int fd, const struct io_uring_cqe* cqe);
+  void handleRecvCompletion(int fd, uint32_t generation, const struct io_uring_cqe* cqe);
+  void setupBufferRing();
+  void recycleBuffer(uint16_t bid);
+  char* recvBuffer(uint16_t bid) const { return recvBuffers_ + static_cast<size_t>(bid) * kRecvBufferSize; }
+  struct io_uring_sqe* getSqe();
+  int enter(unsigned toSubmit, unsigned minComplete, unsigned flags,
+            const void* arg, size_t argSize);
+  void handleCompletion(const struct io_uring_cqe* cqe);
+  void unmapRings();
+
+  static const unsigned kRingEntries = 1024;
+  // 缓冲区环：每个 Loop 256 个 4KB 缓冲区，数量必须是 2 的幂
+  static const unsigned kRecvBufferCount = 256;
+  static const unsigned kRecvBufferSize = 4096;
+
+  int ringFd_;
+  void* sqRing_;
+  size_t sqRingSize_;
+  void* cqRing_;
+  size_t cqRingSize_;
+  struct io_uring_sqe* sqes_;
+  size_t sqesSize_;
+
+  unsigned* sqHead_;
+  unsigned* sqTail_;
+  unsigned sqMask_;
+  unsigned sqEntries_;
+  unsigned sqLocalTail_;
+
+  unsigned* cqHead_;
+  unsigned* cqTail_;
+  unsigned cqMask_;
+  struct io_uring_cqe* cqes_;
+
+  // 以 fd 为下标，每次重新挂 poll 时加一，用来丢弃旧请求的完成事件
+  std::vector<uint32_t> generations_;
+  // 以 fd 为下标，本轮中该 fd 在 activeEvents_ 里的位置加一，同一 fd 的多个完成事件合并
+  std::vector<int> activeSlots_;
+  std::vector<ActiveEvent> activeEvents_;
+
+  // 以监听 fd 为键，本轮接受的连接等 Acceptor 取走
+  std::unordered_map<int, AcceptQueue> acceptQueues_;
+  // 在途发送的回调，以槽位为下标，槽位号放在 user_data 里
+  std::vector<EventLoop::SendCallback> sendCallbacks_;
+  std::vector<uint32_t> freeSendSlots_;
+  std::vector<SendCompletion> completedSends_;
+
+  // 缓冲区环，注册失败（内核早于 5.19）或 multishot recv 不被支持时不用
+  bool recvSupported_;
+  struct io_uring_buf_ring* bufRing_;
+  size_t bufRingSize_;
+  char* recvBuffers_;
+  uint16_t bufRingTail_;
+  // 环里可用的缓冲区数，用完时 recv 以 ENOBUFS 结束，归还后再重新挂上
+  unsigned freeBuffers_;
+  // 以 fd 为下标
+  std::vector<RecvQueue> recvQueues_;
+  std::vector<int> recvRearms_;
+};
+
+#endif  // IOURING_H
@@ -0,0 +1,61 @@
+#include "LoopStats.h"
+
+#include <stdio.h>
+
+const int Histogram::kNumBuckets;
+
+Histogram::Histogram() : count_(0), sum_(0), max_(0)
+{
+  for (int i = 0; i < kNumBuckets; ++i) buckets_[i].store(0, std::memory_order_relaxed);
+}
+
+uint64_t Histogram::mean() const
+{
+  uint64_t n = count();
+  return n == 0 ? 0 : sum_.load(std::memory_order_relaxed) / n;
+}
+
+uint64_t Histogram::percentile(double p) const
+{
+  uint64_t n = count();
+  if (n == 0) return 0;
+  uint64_t target = static_cast<uint64_t>(p * static_cast<double>(n));
+  if (target == 0) target = 1;
+  uint64_t seen = 0;
+  for (int i = 0; i < kNumBuckets; ++i)
+  {
+    seen += buckets_[i].load(std::memory_order_relaxed);
+    if (seen >= target)
+    {
+      uint64_t upper = i == 0 ? 0 : (1ULL << i) - 1;
+      // 桶的上界可能超过实际最大值
+      return upper < max() ? upper : max();
+    }
+  }
+  return max();
+}
+
+std::string Histogram::toString() const
+{
+  char buf[96];
+  snprintf(buf, sizeof buf, "%llu/%llu/%llu",
+           static_cast<unsigned long long>(percentile(0.5)),
+           static_cast<unsigned long long>(percentile(0.99)),
+           static_cast<unsigned long long>(max()));
+  return buf;
+}
+
+std::string LoopStats::toString() const
+{
+  char buf[64];
+  snprintf(buf, sizeof buf, "iterations %llu, p50/p99/max:",
+           static_cast<unsigned long long>(pollWaitUs.count()));
+  std::string result(buf);
+  result += " pollWaitUs " + pollWaitUs.toString();
+  result += " readyEvents " + readyEvents.toString();
+  result += " handleEventsUs " + handleEventsUs.toString();
+  result += " pendingFunctorsUs " + pendingFunctorsUs.toString();
+  result += " expiredTimersUs " + expiredTimersUs.toString();
+  result += " queueLength " + queueLength.toString();
+  return result;
+}
@@ -0,0 +1,60 @@
+#ifndef LOOPSTATS_H
+#define LOOPSTATS_H
+
+#include <stdint.h>
+#include <atomic>
+#include <string>
+
+#include "base/noncopyable.h"
+
+// 按 2 的幂分桶的直方图，第 i 个桶记录 [2^(i-1), 2^i) 的值，0 单独一个桶
+// 只有一个线程写（所属 Loop），写入不用原子读改写；任意线程可以无锁读，读到的是近似快照
+class Histogram : noncopyable {
+ public:
+  static const int kNumBuckets = 40;
+
+  Histogram();
+
+  void record(uint64_t value) {
+    int bucket = value == 0 ? 0 : 64 - __builtin_clzll(value);
+    if (bucket >= kNumBuckets) bucket = kNumBuckets - 1;
+    add(&buckets_[bucket], 1);
+    add(&count_, 1);
+    add(&sum_, value);
+    if (value > max_.load(std::memory_order_relaxed)) {
+      max_.store(value, std::memory_order_relaxed);
+    }
+  }
+
+  uint64_t count() const { return count_.load(std::memory_order_relaxed); }
+  uint64_t max() const { return max_.load(std::memory_order_relaxed); }
+  uint64_t mean() const;
+  // 返回 p 分位所在桶的上界，p 在 (0, 1] 之间
+  uint64_t percentile(double p) const;
+  // "p50/p99/max"
+  std::string toString() const;
+
+ private:
+  static void add(std::atomic<uint64_t>* counter, uint64_t n) {
+    counter->store(counter->load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+  }
+
+  std::atomic<uint64_t> buckets_[kNumBuckets];
+  std::atomic<uint64_t> count_;
+  std::atomic<uint64_t> sum_;
+  std::atomic<uint64_t> max_;
+};
+
+// EventLoop 每轮的统计，时间单位为微秒
+struct LoopStats : noncopyable {
+  Histogram pollWaitUs;
+  Histogram readyEvents;
+  Histogram handleEventsUs;
+  Histogram pendingFunctorsUs;
+  Histogram expiredTimersUs;
+  Histogram queueLength;
+
+  std::string toString() const;
+};
+
+#endif  // LOOPSTATS_H
@@ -3,6 +3,7 @@
 #include <string>
 
 #include "EventLoop.h"
+#include "Poller.h"
 #include "Server.h"
 #include "base/Logging.h"
 
@@ -15,7 +16,17 @@ int main(int argc, char* argv[]) {
   std::string webName = "LP's WebServer";
 
   int opt;
-  const char* str = "t:l:p:";
+  int busyPollUs = 0;
+  Server::AcceptMode acceptMode = Server::kMainAcceptor;
+  bool pinThreads = false;
+  int rebalanceInterval = 0;
+  int computeThreads = 0;
+  int slowCallbackUs = 0;
+  int deferAcceptSeconds = 0;
+  int fastOpenQueueLen = 0;
+  size_t highWaterMark = 0;
+  bool statsEnabled = false;
+  const char* str = "t:l:p:b:s:a:cr:w:d:e:f:z:m:o:i";
   while ((opt = getopt(argc, argv, str)) != -1) {
     switch (opt) {
       case 't': {
@@ -34,6 +45,86 @@ int main(int argc, char* argv[]) {
         port = atoi(optarg);
         break;
       }
+      case 'b': {
+        // I/O 后端：epoll（默认）或 io_uring
+        std::string backend = optarg;
+        if (backend == "io_uring") {
+          Poller::setDefaultBackend(Poller::kIoUring);
+        } else if (backend != "epoll") {
+          printf("backend should be \"epoll\" or \"io_uring\"\n");
+          abort();
+        }
+        break;
+      }
+      case 's': {
+        // 自适应忙轮询预算（微秒），0 关闭
+        busyPollUs = atoi(optarg);
+        break;
+      }
+      case 'a': {
+        // 接受连接方式：main（主 Loop 接受），loop（每个 Loop 一个 reuseport socket），
+        // cpu（同 loop，再按收包 CPU 分流）
+        std::string mode = optarg;
+        if (mode == "loop") {
+          acceptMode = Server::kPerLoopAcceptors;
+        } else if (mode == "cpu") {
+          acceptMode = Server::kCpuSteeredAcceptors;
+        } else if (mode != "main") {
+          printf("accept mode should be \"main\", \"loop\" or \"cpu\"\n");
+          abort();
+        }
+        break;
+      }
+      case 'c': {
+        // I/O 线程绑核
+        pinThreads = true;
+        break;
+      }
+      case 'r': {
+        // 连接迁移的周期（秒），0 关闭
+        rebalanceInterval = atoi(optarg);
+        break;
+      }
+      case 'w': {
+        // 计算线程数，0 表示 CPU 密集的处理函数在 I/O 线程中运行
+        computeThreads = atoi(optarg);
+        break;
+      }
+      case 'd': {
+        // 慢回调阈值（微秒），0 关闭
+        slowCallbackUs = atoi(optarg);
+        break;
+      }
+      case 'e': {
+        // TCP_DEFER_ACCEPT 秒数，0 关闭
+        deferAcceptSeconds = atoi(optarg);
+        break;
+      }
+      case 'f': {
+        // TCP Fast Open 队列长度，0 关闭
+        fastOpenQueueLen = atoi(optarg);
+        break;
+      }
+      case 'z': {
+        // 不小于该字节数的内存响应体用 MSG_ZEROCOPY 发送，0 关闭
+        HttpServer::setZeroCopyThreshold(static_cast<size_t>(atol(optarg)));
+        break;
+      }
+      case 'm': {
+        // 单个连接输出队列的高水位（字节），回落到四分之一时恢复读，0 关闭
+        highWaterMark = static_cast<size_t>(atol(optarg));
+        break;
+      }
+      case 'o': {
+        // 所有连接输出队列占用内存的总预算（字节），0 关闭
+        HttpServer::setOutputMemoryBudget(static_cast<size_t>(atol(optarg)));
+        break;
+      }
+      case 'i': {
+        // 开启 /stats，报告各 I/O Loop 的延迟统计
+        statsEnabled = true;
+        break;
+      }
       default:
         break;
     }
@@ -44,8 +135,31 @@ int main(int argc, char* argv[]) {
   LOG_INFO << "_PTHREADS is not defined !";
 #endif
   EventLoop mainLoop;
+  mainLoop.setBusyPollBudget(busyPollUs);
+  mainLoop.setSlowCallbackThreshold(slowCallbackUs);
   Server myHTTPServer(&mainLoop, port, webName, threadNum,
                       true);
+  myHTTPServer.setThreadInitCallback(
+      [busyPollUs, slowCallbackUs](EventLoop* loop) {
+        loop->setBusyPollBudget(busyPollUs);
+        loop->setSlowCallbackThreshold(slowCallbackUs);
+      });
+  myHTTPServer.setAcceptMode(acceptMode);
+  myHTTPServer.setPinThreads(pinThreads);
+  myHTTPServer.setRebalanceInterval(rebalanceInterval);
+  myHTTPServer.setComputeThreads(computeThreads);
+  myHTTPServer.setDeferAccept(deferAcceptSeconds);
+  myHTTPServer.setFastOpen(fastOpenQueueLen);
+  myHTTPServer.setOutputWaterMarks(highWaterMark, highWaterMark / 4);
+  myHTTPServer.setHighWaterMarkCallback([](const HttpServerPtr& conn, size_t queued) {
+    LOG_WARN << "connection fd = " << conn->getFd() << " output " << queued
+             << " bytes above high water mark, pause reading";
+  });
+  if (statsEnabled) {
+    HttpServer::registerHandler("/stats", [&myHTTPServer](const HttpRequest&, HttpResponse* response) {
+      response->body = myHTTPServer.loopStats();
+    });
+  }
   myHTTPServer.start();
   mainLoop.loop();
   return 0;
@@ -0,0 +1,327 @@
+#include "OutputQueue.h"
+
+#include <errno.h>
+#include <linux/errqueue.h>
+#include <netinet/in.h>
+#include <string.h>
+#include <sys/sendfile.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <unistd.h>
+#include <algorithm>
+
+const int OutputQueue::kMaxIovecs;
+const int OutputQueue::kMaxAsyncIovecs;
+
+SharedFile::~SharedFile() { close(fd_); }
+
+OutputQueue::OutputQueue(BufferPool* pool)
+    : bytes_(pool),
+      size_(0),
+      memoryBytes_(0),
+#ifdef MSG_ZEROCOPY
+      zeroCopyState_(kZeroCopyUnknown),
+#else
+      zeroCopyState_(kZeroCopyOff),
+#endif
+      nextZeroCopyId_(0),
+      asyncBytes_(pool),
+      asyncSendInFlight_(false),
+      asyncSendDiscarded_(false),
+      frozenSegments_(0)
+{
+  memset(&asyncMsg_, 0, sizeof asyncMsg_);
+}
+
+void OutputQueue::append(const char* data, size_t len)
+{
+  if (len == 0) return;
+  bytes_.append(data, len);
+  if (!segments_.empty() && segments_.back().type == kBytes && segments_.size() > frozenSegments_)
+  {
+    segments_.back().len += len;
+  }
+  else
+  {
+    Segment seg;
+    seg.type = kBytes;
+    seg.len = len;
+    seg.offset = 0;
+    seg.zeroCopy = false;
+    segments_.push_back(std::move(seg));
+  }
+  size_ += len;
+  memoryBytes_ += len;
+}
+
+void OutputQueue::appendBlob(const Blob& blob, size_t offset, size_t len, bool zeroCopy)
+{
+  assert(offset + len <= blob->size());
+  if (len == 0) return;
+  Segment seg;
+  seg.type = kBlob;
+  seg.len = len;
+  seg.offset = static_cast<off_t>(offset);
+  seg.blob = blob;
+  seg.zeroCopy = zeroCopy;
+  segments_.push_back(std::move(seg));
+  size_ += len;
+  memoryBytes_ += len;
+}
+
+void OutputQueue::appendFile(const SharedFilePtr& file, off_t offset, size_t len)
+{
+  if (len == 0) return;
+  Segment seg;
+  seg.type = kFile;
+  seg.len = len;
+  seg.offset = offset;
+  seg.file = file;
+  seg.zeroCopy = false;
+  segments_.push_back(std::move(seg));
+  size_ += len;
+}
+
+int OutputQueue::fillIovecs(struct iovec* vec, int maxIovecs) const
+{
+  int iovcnt = 0;
+  // 自有字节段在 bytes_ 中按顺序紧挨着存放
+  const char* bytes = bytes_.peek();
+  for (const Segment& seg : segments_)
+  {
+    // 零拷贝段单独发送，不能和随后会被覆盖的自有字节一起交给内核引用
+    if (seg.type == kFile || sendsZeroCopy(seg) || iovcnt == maxIovecs) break;
+    if (seg.type == kBytes)
+    {
+      vec[iovcnt].iov_base = const_cast<char*>(bytes);
+      bytes += seg.len;
+    }
+    else
+    {
+      vec[iovcnt].iov_base = const_cast<char*>(seg.blob->data() + seg.offset);
+    }
+    vec[iovcnt].iov_len = seg.len;
+    ++iovcnt;
+  }
+  return iovcnt;
+}
+
+void OutputQueue::consume(size_t n)
+{
+  assert(n <= size_);
+  size_ -= n;
+  while (n > 0)
+  {
+    Segment& seg = segments_.front();
+    size_t taken = std::min(n, seg.len);
+    if (seg.type != kFile) memoryBytes_ -= taken;
+    if (seg.type == kBytes)
+      bytes_.retrieve(taken);
+    else
+      seg.offset += static_cast<off_t>(taken);
+    seg.len -= taken;
+    n -= taken;
+    if (seg.len == 0) segments_.pop_front();
+  }
+}
+
+ssize_t OutputQueue::writeFd(int fd, int* savedErrno)
+{
+  assert(!asyncSendInFlight_);
+  ssize_t total = 0;
+  while (!segments_.empty())
+  {
+    const Segment& front = segments_.front();
+    ssize_t n;
+    if (front.type == kFile)
+    {
+      off_t offset = front.offset;
+      n = ::sendfile(fd, front.file->fd(), &offset, front.len);
+      if (n == 0)
+      {
+        // 文件比登记的长度短
+        *savedErrno = EIO;
+        return -1;
+      }
+    }
+    else if (sendsZeroCopy(front))
+    {
+      n = sendZeroCopy(fd, front, segments_.size() > 1);
+    }
+    else
+    {
+      struct iovec vec[kMaxIovecs];
+      const int iovcnt = fillIovecs(vec, kMaxIovecs);
+      if (segments_.size() > static_cast<size_t>(iovcnt))
+      {
+        // 后面还有文件段（或超出 iovec 上限），MSG_MORE 让响应头和文件开头合成一个报文段
+        // 最后一次写不带该标志，队列写空时协议栈立即推送
+        struct msghdr msg;
+        memset(&msg, 0, sizeof msg);
+        msg.msg_iov = vec;
+        msg.msg_iovlen = iovcnt;
+        n = ::sendmsg(fd, &msg, MSG_MORE);
+      }
+      else
+      {
+        n = ::writev(fd, vec, iovcnt);
+      }
+    }
+    if (n < 0)
+    {
+      if (errno == EAGAIN || errno == EWOULDBLOCK) break;
+      *savedErrno = errno;
+      return -1;
+    }
+    consume(static_cast<size_t>(n));
+    total += n;
+  }
+  return total;
+}
+
+const struct msghdr* OutputQueue::prepareAsyncSend(int* flags)
+{
+  assert(!asyncSendInFlight_);
+  const int iovcnt = fillIovecs(asyncIov_, kMaxAsyncIovecs);
+  if (iovcnt == 0) return NULL;
+  memset(&asyncMsg_, 0, sizeof asyncMsg_);
+  asyncMsg_.msg_iov = asyncIov_;
+  asyncMsg_.msg_iovlen = iovcnt;
+  for (int i = 0; i < iovcnt; ++i)
+  {
+    if (segments_[i].type == kBlob) asyncBlobs_[i] = segments_[i].blob;
+  }
+  // 同 writeFd，后面还有数据时带 MSG_MORE
+  *flags = segments_.size() > static_cast<size_t>(iovcnt) ? MSG_MORE : 0;
+  // iovec 指向 bytes_ 当前的存储，把它整个换出去，之后的追加不会移动这些字节
+  assert(asyncBytes_.readableBytes() == 0);
+  asyncBytes_.swap(bytes_);
+  frozenSegments_ = segments_.size();
+  asyncSendInFlight_ = true;
+  asyncSendDiscarded_ = false;
+  return &asyncMsg_;
+}
+
+void OutputQueue::completeAsyncSend(size_t n)
+{
+  assert(asyncSendInFlight_);
+  asyncSendInFlight_ = false;
+  frozenSegments_ = 0;
+  for (Blob& blob : asyncBlobs_) blob.reset();
+  if (asyncSendDiscarded_)
+  {
+    asyncBytes_.releaseStorage();
+    return;
+  }
+  // 换回在途的存储，其中的字节在队列里排在前面
+  bytes_.swap(asyncBytes_);
+  consume(n);
+  if (asyncBytes_.readableBytes() > 0)
+  {
+    // 在途期间追加的字节接到后面，旧的已经发完时直接换过来
+    if (bytes_.readableBytes() == 0)
+    {
+      bytes_.swap(asyncBytes_);
+    }
+    else
+    {
+      bytes_.append(asyncBytes_.peek(), asyncBytes_.readableBytes());
+    }
+  }
+  asyncBytes_.retrieveAll();
+}
+
+ssize_t OutputQueue::sendZeroCopy(int fd, const Segment& seg, bool more)
+{
+  const char* data = seg.blob->data() + seg.offset;
+  const int moreFlag = more ? MSG_MORE : 0;
+#ifdef MSG_ZEROCOPY
+  if (zeroCopyState_ == kZeroCopyUnknown)
+  {
+    int one = 1;
+    zeroCopyState_ = ::setsockopt(fd, SOL_SOCKET, SO_ZEROCOPY, &one,
+                                  static_cast<socklen_t>(sizeof one)) == 0
+                         ? kZeroCopyOn
+                         : kZeroCopyOff;
+  }
+  if (zeroCopyState_ == kZeroCopyOn)
+  {
+    ssize_t n = ::send(fd, data, seg.len, MSG_ZEROCOPY | moreFlag);
+    if (n >= 0)
+    {
+      ZeroCopyPin pin = {nextZeroCopyId_++, seg.blob};
+      zeroCopyPins_.push_back(std::move(pin));
+      return n;
+    }
+    // ENOBUFS：可锁定的内存用完了，这次退回拷贝
+    if (errno != ENOBUFS) return n;
+  }
+#endif
+  return ::send(fd, data, seg.len, moreFlag);
+}
+
+void OutputQueue::handleZeroCopyCompletions(int fd)
+{
+  if (reapZeroCopyCompletions(fd, &zeroCopyPins_))
+  {
+    // 内核还是做了拷贝，零拷贝只剩额外开销
+    zeroCopyState_ = kZeroCopyOff;
+  }
+}
+
+bool OutputQueue::reapZeroCopyCompletions(int fd, ZeroCopyPins* pins)
+{
+  bool copied = false;
+#ifdef SO_EE_ORIGIN_ZEROCOPY
+  while (!pins->empty())
+  {
+    char control[128];
+    struct msghdr msg;
+    memset(&msg, 0, sizeof msg);
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof control;
+    if (::recvmsg(fd, &msg, MSG_ERRQUEUE) < 0) break;
+    for (struct cmsghdr* cm = CMSG_FIRSTHDR(&msg); cm != NULL; cm = CMSG_NXTHDR(&msg, cm))
+    {
+      if (!((cm->cmsg_level == SOL_IP && cm->cmsg_type == IP_RECVERR) ||
+            (cm->cmsg_level == SOL_IPV6 && cm->cmsg_type == IPV6_RECVERR)))
+      {
+        continue;
+      }
+      const struct sock_extended_err* err =
+          reinterpret_cast<const struct sock_extended_err*>(CMSG_DATA(cm));
+      if (err->ee_errno != 0 || err->ee_origin != SO_EE_ORIGIN_ZEROCOPY) continue;
+      if (err->ee_code & SO_EE_CODE_ZEROCOPY_COPIED) copied = true;
+      // 编号区间 [lo, hi]，按无符号差值比较，允许回绕
+      const uint32_t lo = err->ee_info;
+      const uint32_t hi = err->ee_data;
+      pins->erase(std::remove_if(pins->begin(), pins->end(),
+                                 [lo, hi](const ZeroCopyPin& pin) { return pin.id - lo <= hi - lo; }),
+                  pins->end());
+    }
+  }
+#else
+  (void)fd;
+#endif
+  return copied;
+}
+
+void OutputQueue::clear()
+{
+  if (asyncSendInFlight_)
+  {
+    asyncSendDiscarded_ = true;
+    frozenSegments_ = 0;
+  }
+  segments_.clear();
+  bytes_.retrieveAll();
+  size_ = 0;
+  memoryBytes_ = 0;
+}
+
+void OutputQueue::releaseStorage()
+{
+  clear();
+  bytes_.releaseStorage();
+  if (!asyncSendInFlight_) asyncBytes_.releaseStorage();
+}
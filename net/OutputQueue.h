@@ -0,0 +1,141 @@
+#ifndef OUTPUTQUEUE_H
+#define OUTPUTQUEUE_H
+
+#include "Buffer.h"
+#include "base/noncopyable.h"
+
+#include <stdint.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+#include <deque>
+#include <memory>
+#include <string>
+
+// 引用计数的只读文件，最后一个引用释放时关闭 fd
+class SharedFile : noncopyable {
+ public:
+  SharedFile(int fd, off_t size) : fd_(fd), size_(size) {}
+  ~SharedFile();
+  int fd() const { return fd_; }
+  off_t size() const { return size_; }
+
+ private:
+  const int fd_;
+  const off_t size_;
+};
+
+typedef std::shared_ptr<const SharedFile> SharedFilePtr;
+
+// 连接的输出队列，按顺序由三种段组成：
+//   自有字节：拷贝进队列内部的 Buffer
+//   共享数据块：引用计数的只读内存（如缓存的文件），不拷贝；可以要求用 MSG_ZEROCOPY 发送，
+//     内核直接引用这段内存，数据块一直被持有到错误队列报告发送完成
+//   文件区间：fd 上的一段，用 sendfile 发送
+class OutputQueue : noncopyable {
+ public:
+  typedef std::shared_ptr<const std::string> Blob;
+  // 每次成功的 MSG_ZEROCOPY 发送由内核按顺序编号，完成通知给出编号区间
+  struct ZeroCopyPin {
+    uint32_t id;
+    Blob blob;
+  };
+  typedef std::deque<ZeroCopyPin> ZeroCopyPins;
+
+  // 读空 fd 错误队列中的完成通知，从 pins 中释放对应的数据块
+  // 内核报告实际做了拷贝时返回 true
+  static bool reapZeroCopyCompletions(int fd, ZeroCopyPins* pins);
+
+  explicit OutputQueue(BufferPool* pool);
+
+  size_t readableBytes() const { return size_; }
+  // 占用内存的部分（自有字节和数据块），不含文件区间
+  size_t memoryBytes() const { return memoryBytes_; }
+  bool empty() const { return size_ == 0; }
+
+  void append(const char* data, size_t len);
+  void appendBlob(const Blob& blob, size_t offset, size_t len, bool zeroCopy = false);
+  void appendBlob(const Blob& blob) { appendBlob(blob, 0, blob->size()); }
+  void appendFile(const SharedFilePtr& file, off_t offset, size_t len);
+
+  // 用 writev/sendfile 尽量写出，直到写完或 EAGAIN
+  // 返回写出的字节数，出错返回 -1 并设置 *savedErrno；异步发送在途时不能调用
+  ssize_t writeFd(int fd, int* savedErrno);
+
+  // 异步发送（io_uring SENDMSG）：为队首的一批自有字节和数据块准备 msghdr，*flags 为发送标志
+  // 在途期间这批字节的存储保持不动，新追加的字节写到另一块存储里
+  // 队首是文件区间或零拷贝段时返回 NULL，改用 writeFd
+  const struct msghdr* prepareAsyncSend(int* flags);
+  // 异步发送完成，n 为内核发出的字节数，出错时为 0
+  void completeAsyncSend(size_t n);
+  bool asyncSendInFlight() const { return asyncSendInFlight_; }
+
+  // 是否还有零拷贝发送的数据块等待内核释放
+  bool hasZeroCopyPending() const { return !zeroCopyPins_.empty(); }
+  // EPOLLERR 时调用，读空 socket 错误队列中的完成通知并释放对应的数据块
+  void handleZeroCopyCompletions(int fd);
+  // 连接关闭时交出还没被内核释放的数据块，由 ZeroCopyLinger 继续等待
+  ZeroCopyPins takeZeroCopyPins() {
+    ZeroCopyPins pins;
+    pins.swap(zeroCopyPins_);
+    return pins;
+  }
+
+  // 不影响等待内核释放的零拷贝数据块；异步发送在途的字节存储和数据块保留到完成
+  void clear();
+  // 清空并把字节存储归还给内存池
+  void releaseStorage();
+  // 队列为空时换用另一个内存池
+  void resetPool(BufferPool* pool) {
+    assert(empty() && !asyncSendInFlight_);
+    bytes_.resetPool(pool);
+    asyncBytes_.resetPool(pool);
+  }
+
+ private:
+  enum SegmentType { kBytes, kBlob, kFile };
+  // 第一次零拷贝发送时给 socket 打开 SO_ZEROCOPY；失败或内核报告实际做了拷贝（如回环）后不再使用
+  enum ZeroCopyState { kZeroCopyUnknown, kZeroCopyOn, kZeroCopyOff };
+
+  struct Segment {
+    SegmentType type;
+    size_t len;
+    off_t offset;
+    Blob blob;
+    SharedFilePtr file;
+    bool zeroCopy;
+  };
+
+  static const int kMaxIovecs = 64;
+  // 异步发送的 iovec 放在对象里，要一直有效到完成，取小一些
+  static const int kMaxAsyncIovecs = 8;
+
+  bool sendsZeroCopy(const Segment& seg) const {
+    return seg.zeroCopy && zeroCopyState_ != kZeroCopyOff;
+  }
+  int fillIovecs(struct iovec* vec, int maxIovecs) const;
+  ssize_t sendZeroCopy(int fd, const Segment& seg, bool more);
+  void consume(size_t n);
+
+  Buffer bytes_;
+  std::deque<Segment> segments_;
+  size_t size_;
+  size_t memoryBytes_;
+  ZeroCopyState zeroCopyState_;
+  uint32_t nextZeroCopyId_;
+  ZeroCopyPins zeroCopyPins_;
+
+  // 异步发送在途时保存交给内核的那批自有字节，bytes_ 换成新的存储
+  Buffer asyncBytes_;
+  bool asyncSendInFlight_;
+  // 在途期间被 clear，完成时直接丢弃
+  bool asyncSendDiscarded_;
+  // 在途时前这么多段的自有字节在 asyncBytes_ 里，追加的字节不能并入这些段
+  size_t frozenSegments_;
+  struct msghdr asyncMsg_;
+  struct iovec asyncIov_[kMaxAsyncIovecs];
+  // asyncIov_ 引用的数据块，在途期间即使段被 clear 也要持有到完成
+  Blob asyncBlobs_[kMaxAsyncIovecs];
+};
+
+#endif  // OUTPUTQUEUE_H
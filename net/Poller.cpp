@@ -0,0 +1,95 @@
+#include "Poller.h"
+#include "Epoll.h"
+#include "IoUring.h"
+#include "base/Logging.h"
+
+#include <algorithm>
+
+namespace {
+const int kNew = -1;
+const int kAdded = 1;
+const int kDeleted = 2;
+}  // namespace
+
+Poller::Backend Poller::defaultBackend_ = Poller::kEpoll;
+
+Poller::Poller(EventLoop* loop) : loop_(loop) {}
+
+Poller::~Poller() {}
+
+Poller* Poller::newDefaultPoller(EventLoop* loop) {
+  if (defaultBackend_ == kIoUring) {
+    IoUring* ring = new IoUring(loop);
+    if (ring->valid()) return ring;
+    delete ring;
+    LOG_WARN << "io_uring unavailable, falling back to epoll";
+  }
+  return new Epoll(loop);
+}
+
+void Poller::updateChannel(Channel* channel) {
+  assertInLoopThread();
+  const int fd = channel->getFd(), state = channel->getState();
+  if (state == kNew)
+  {
+    if (static_cast<size_t>(fd) >= channels_.size())
+    {
+      ChannelEntry empty = {NULL, 0};
+      channels_.resize(std::max(static_cast<size_t>(fd) + 1, channels_.size() * 2), empty);
+    }
+    assert(channels_[fd].channel == NULL);
+    channels_[fd].channel = channel;
+    channels_[fd].events = 0;
+    channel->setState(kDeleted);
+  }
+
+  assert(hasChannel(channel));
+  if (channel->getState() == kDeleted)
+  {
+    if (!channel->isNoneEvent())
+    {
+      channel->setState(kAdded);
+      submit(EPOLL_CTL_ADD, channel);
+    }
+  }
+  else
+  {
+    assert(channel->getState() == kAdded);
+    if (channel->isNoneEvent())
+    {
+      channel->setState(kDeleted);
+      submit(EPOLL_CTL_DEL, channel);
+    } 
+    else if (channel->getEvents() != channels_[fd].events)
+    {
+      submit(EPOLL_CTL_MOD, channel);
+    }
+  }
+}
+
+void Poller::removeChannel(Channel* channel) {
+  assertInLoopThread();
+  const int state = channel->getState(), fd = channel->getFd();
+  // 更新还没提交过，内核和表里都没有它
+  if (state == kNew) return;
+  assert(hasChannel(channel));
+  assert(channel->isNoneEvent());
+  assert(state == kDeleted || state == kAdded);
+  if (state == kAdded) {
+    submit(EPOLL_CTL_DEL, channel);
+  }
+  channels_[fd].channel = NULL;
+  channel->setState(kNew);
+}
+
+bool Poller::hasChannel(Channel* channel) const {
+  assertInLoopThread();
+  const size_t fd = static_cast<size_t>(channel->getFd());
+  return fd < channels_.size() && channels_[fd].channel == channel;
+}
+
+void Poller::submit(int operation, Channel* channel) {
+  channels_[channel->getFd()].events =
+      operation == EPOLL_CTL_DEL ? 0 : channel->getEvents();
+  update(operation, channel);
+}
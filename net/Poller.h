@@ -0,0 +1,78 @@
+#ifndef POLLER_H
+#define POLLER_H
+
+#include <sys/types.h>
+#include <vector>
+
+#include "Channel.h"
+#include "EventLoop.h"
+
+class Buffer;
+
+// I/O 多路复用后端的接口，EventLoop 通过它等待就绪事件
+// channel 表、状态机和净变化判断在这里实现，后端只负责把 ADD/MOD/DEL 提交给内核
+class Poller : noncopyable {
+ public:
+  enum Backend { kEpoll, kIoUring };
+
+  explicit Poller(EventLoop* loop);
+  virtual ~Poller();
+
+  // 按 setDefaultBackend 选择的后端创建，io_uring 不可用时退回 epoll
+  static Poller* newDefaultPoller(EventLoop* loop);
+  // 在创建任何 EventLoop 之前调用
+  static void setDefaultBackend(Backend backend) { defaultBackend_ = backend; }
+
+  // 返回就绪事件数，由 activeChannel() 逐个取出分发
+  virtual int poll(int timeout) = 0;
+  // 第 i 个就绪的 channel，revents 已设置
+  virtual Channel* activeChannel(int i) = 0;
+  // 第 [from, numEvents) 个就绪事件中是否有 channel
+  virtual bool hasPendingEvent(Channel* channel, int from, int numEvents) const = 0;
+
+  // 以下是完成式操作，只有 io_uring 后端支持，其他后端返回 false，调用者退回就绪通知加同步系统调用
+  // 由内核持续接受监听 fd 上的连接，channel 读就绪时用 takeAccepted 取走；在 channel 注册之前调用
+  virtual bool enableAcceptCompletion(int listenFd) { return false; }
+  // 取走已经接受的连接，负数为 -errno；返回 false 表示已退回就绪通知（如内核不支持 multishot accept）
+  virtual bool takeAccepted(int listenFd, std::vector<int>* connfds) { return false; }
+  virtual bool canSubmitSend() const { return false; }
+  // sendmsg 放进提交队列，和本轮其他请求一起在下一次 poll 时提交
+  // msg 及其引用的数据在完成前必须保持不变，完成后由 runCompletions 调用 cb(字节数或 -errno)
+  virtual bool submitSend(int fd, const struct msghdr* msg, int flags,
+                          EventLoop::SendCallback&& cb) { return false; }
+  // 由内核持续把连接 fd 上的数据收进 Loop 的缓冲区，channel 读就绪时用 takeReceived 取走；在 channel 注册之前调用
+  virtual bool enableRecvCompletion(int fd) { return false; }
+  // 把已经收到的数据追加到 buf，*n 和 *savedErrno 的含义同 Buffer::readFd（没有数据时为 EAGAIN）
+  // 返回 false 表示该 fd 不用 recv 完成，调用者自己读
+  virtual bool takeReceived(int fd, Buffer* buf, ssize_t* n, int* savedErrno) { return false; }
+  // 在本轮事件分发之后调用
+  virtual void runCompletions() {}
+
+  // 只把与已注册事件不同的净变化提交给后端
+  void updateChannel(Channel* channel);
+  void removeChannel(Channel* channel);
+  bool hasChannel(Channel* channel) const;
+
+  void assertInLoopThread() const { loop_->assertInLoopThread(); }
+
+ protected:
+  // operation 为 EPOLL_CTL_ADD / EPOLL_CTL_MOD / EPOLL_CTL_DEL
+  virtual void update(int operation, Channel* channel) = 0;
+
+  struct ChannelEntry {
+    Channel* channel;
+    uint32_t events;  // 已经注册到内核的事件
+  };
+  // 以 fd 为下标，fd 由内核从小到大分配，表是稠密的
+  typedef std::vector<ChannelEntry> ChannelTable;
+
+  ChannelTable channels_;
+
+ private:
+  void submit(int operation, Channel* channel);
+
+  EventLoop* loop_;
+  static Backend defaultBackend_;
+};
+
+#endif  // POLLER_H
@@ -5,53 +5,188 @@
 #include <arpa/inet.h>
 #include <netdb.h>
 #include <netinet/in.h>
+#include <sched.h>
 #include <sys/socket.h>
-#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+#include <algorithm>
+
+namespace {
+// 最忙和最闲的 Loop 连接数相差超过这么多才迁移
+const int kRebalanceThreshold = 4;
+// 每轮最多迁移的连接数
+const int kMaxMigrationsPerRound = 64;
+}  // namespace
 
 Server::Server(EventLoop* loop, const int port,
                const string name, int numThreads, bool reuseport)
-    : serverLoop_(CHECK_NOTNULL(loop)),
+    : started_(false),
+      serverLoop_(CHECK_NOTNULL(loop)),
       port_(port),
       name_(name),
+      reuseport_(reuseport),
+      acceptMode_(kMainAcceptor),
+      pinThreads_(false),
+      rebalanceInterval_(0),
+      computeThreads_(0),
+      deferAcceptSeconds_(0),
+      fastOpenQueueLen_(0),
+      highWaterMark_(0),
+      lowWaterMark_(0),
       listenFd_(socket_bind(port_, reuseport)),
-      eventLoopThreadPool_(new EventLoopThreadPool(serverLoop_, name, numThreads)),
-      started_(false),
-      listening_(false),
-      acceptChannel_(new Channel(serverLoop_, listenFd_)),
-      idleFd_(open("/dev/null", O_RDONLY | O_CLOEXEC)) {
-  assert(idleFd_ >= 0);
+      eventLoopThreadPool_(new EventLoopThreadPool(serverLoop_, name, numThreads)) {
   handle_for_sigpipe();
-  acceptChannel_->setReadHandler(std::bind(&Server::handleNewConn, this));
 }
 
 Server::~Server()
 {
   serverLoop_->assertInLoopThread();
 
-  for (auto& item : connections_)
+  if (computePool_)
+  {
+    computePool_->stop();
+    HttpServer::setComputePool(NULL);
+  }
+  serverLoop_->cancel(rebalanceTimer_);
+  for (EventLoop* loop : loops_)
   {
-    HttpServerPtr conn(item.second);
-    item.second.reset();
-    conn->getLoop()->runInLoop(
-      std::bind(&HttpServer::connectDestroyed, conn));
+    loop->runInLoop(std::bind(&Server::destroyConnections, loop));
+  }
+  // 每个 Acceptor 的 Channel 只能在自己的 Loop 线程中移除
+  for (Acceptor* acceptor : loopAcceptors_)
+  {
+    acceptor->getLoop()->runInLoop([acceptor] { delete acceptor; });
   }
-  close(idleFd_);
 }
 
 void Server::start()
 {
   assert(!started_);
-  assert(!listening_);
   started_ = true;
-  listening_ = true;
-  int ret = listen(listenFd_, LISTENQ);
-  if (ret < 0)
+  eventLoopThreadPool_->start(threadInitCallback_);
+  loops_ = eventLoopThreadPool_->getAllLoops();
+  if (computeThreads_ > 0)
+  {
+    computePool_.reset(new WorkStealingPool(name_ + "-compute", computeThreads_));
+    computePool_->start();
+    HttpServer::setComputePool(computePool_.get());
+  }
+  if (rebalanceInterval_ > 0)
+  {
+    rebalanceTimer_ = serverLoop_->runEvery(rebalanceInterval_ * 1000,
+                                            std::bind(&Server::rebalance, this));
+  }
+  if (acceptMode_ != kMainAcceptor && !reuseport_)
+  {
+    LOG_WARN << "Server::start per-loop acceptors need SO_REUSEPORT, fall back to main acceptor";
+    acceptMode_ = kMainAcceptor;
+  }
+  if (acceptMode_ != kMainAcceptor)
+  {
+    startLoopAcceptors();
+    return;
+  }
+
+  setListenOptions(listenFd_);
+  if (listen(listenFd_, LISTENQ) < 0)
   {
     LOG_SYSFATAL << "Server::start";
   }
-  eventLoopThreadPool_->start(threadInitCallback_);
-  acceptChannel_->setET();
-  acceptChannel_->enableReading();
+  for (size_t i = 0; i < loops_.size(); ++i)
+  {
+    acceptInboxes_.emplace_back(new MpscQueue<int>);
+  }
+  handoffPending_.assign(loops_.size(), false);
+  acceptor_.reset(new Acceptor(serverLoop_, listenFd_));
+  acceptor_->setNewConnectionCallback(
+      std::bind(&Server::newConnection, this, std::placeholders::_1, std::placeholders::_2));
+  acceptor_->setAcceptBurstCallback(std::bind(&Server::handoffAccepted, this));
+  acceptor_->listen();
+}
+
+void Server::setListenOptions(int listenFd)
+{
+  if (deferAcceptSeconds_ > 0 && !::setDeferAccept(listenFd, deferAcceptSeconds_))
+  {
+    LOG_SYSERR << "Server::setListenOptions TCP_DEFER_ACCEPT";
+  }
+  if (fastOpenQueueLen_ > 0 && !::setFastOpen(listenFd, fastOpenQueueLen_))
+  {
+    LOG_SYSERR << "Server::setListenOptions TCP_FASTOPEN";
+  }
+}
+
+string Server::loopStats() const
+{
+  string result;
+  for (size_t i = 0; i < loops_.size(); ++i)
+  {
+    const EventLoop* loop = loops_[i];
+    char buf[96];
+    snprintf(buf, sizeof buf, "loop %zu: connections %d, latencyUs %lld, ",
+             i, loop->numConnections(), static_cast<long long>(loop->loopLatencyUs()));
+    result += buf;
+    result += loop->stats().toString();
+    result += "\n";
+  }
+  return result;
+}
+
+void Server::startLoopAcceptors()
+{
+  const std::vector<EventLoop*>& loops = loops_;
+  const int numLoops = static_cast<int>(loops.size());
+  // 内核按 listen 的先后给 reuseport 组内的 socket 编号，CBPF 程序返回的就是这个编号
+  // 所以这里在主线程中按 Loop 顺序依次 listen，第 i 个 socket 属于第 i 个 Loop
+  if (acceptMode_ == kCpuSteeredAcceptors)
+  {
+    attachCpuSteering();
+  }
+  for (int i = 0; i < numLoops; ++i)
+  {
+    EventLoop* loop = loops[i];
+    int listenFd = i == 0 ? listenFd_ : socket_bind(port_, true);
+    setListenOptions(listenFd);
+    if (listen(listenFd, LISTENQ) < 0)
+    {
+      LOG_SYSFATAL << "Server::startLoopAcceptors";
+    }
+    Acceptor* acceptor = new Acceptor(loop, listenFd);
+    acceptor->setNewConnectionCallback(
+        std::bind(&Server::newLocalConnection, this, loop,
+                  std::placeholders::_1, std::placeholders::_2));
+    loopAcceptors_.push_back(acceptor);
+    loop->runInLoop(std::bind(&Acceptor::listen, acceptor));
+  }
+  LOG_INFO << "Server::start [" << name_ << "] " << numLoops
+           << " per-loop acceptors on port " << port_;
+}
+
+// CBPF 程序按绑核结果把每个 CPU 映射到该 CPU 上的 Loop 的监听 socket
+// 没有绑核时 Loop 线程在 CPU 间漂移，收包 CPU 和处理的 Loop 没有对应关系，不挂程序
+void Server::attachCpuSteering()
+{
+  std::vector<int> socketOfCpu;
+  if (pinThreads_)
+  {
+    for (int cpu = 0; cpu < CPU_SETSIZE; ++cpu)
+    {
+      EventLoop* loop = eventLoopThreadPool_->getLoopForCpu(cpu);
+      if (loop == NULL) continue;
+      socketOfCpu.resize(cpu + 1, -1);
+      socketOfCpu[cpu] = static_cast<int>(std::find(loops_.begin(), loops_.end(), loop) - loops_.begin());
+    }
+  }
+  if (socketOfCpu.empty())
+  {
+    LOG_WARN << "Server::startLoopAcceptors cpu steering needs pinned I/O threads, "
+             << "falling back to reuseport hashing";
+    return;
+  }
+  if (!setReusePortCpuSteering(listenFd_, socketOfCpu))
+  {
+    LOG_SYSERR << "Server::startLoopAcceptors SO_ATTACH_REUSEPORT_CBPF";
+  }
 }
 
 int Server::socket_bind(const int port, bool reuseport) {
@@ -86,58 +221,23 @@ int Server::socket_bind(const int port, bool reuseport) {
   return listenfd;
 }
 
-void Server::handleNewConn() {
-  serverLoop_->assertInLoopThread();
-  assert(listening_);
-  struct sockaddr clientAddr;
-  memset(&clientAddr, 0, sizeof(struct sockaddr));
-  socklen_t addrLen = sizeof(clientAddr);
-  int connfd;
-  while ((connfd = accept4(listenFd_, &clientAddr, &addrLen, SOCK_NONBLOCK | SOCK_CLOEXEC)) >= 0)
-  {
-    setNoDelay(connfd, true);
-    newConnection(connfd, &clientAddr);
-  }
-  int savedErrno = errno;
-  switch (savedErrno)
-  {
-    case EAGAIN:
-    case ECONNABORTED:
-    case EINTR:
-    case EPROTO:
-    case EPERM:
-    case EMFILE:
-      break;
-    case EBADF:
-    case EFAULT:
-    case EINVAL:
-    case ENFILE:
-    case ENOBUFS:
-    case ENOMEM:
-    case ENOTSOCK:
-    case EOPNOTSUPP:
-      // unexpected errors
-      LOG_FATAL << "unexpected error of accept4 " << savedErrno;
-      break;
-    default:
-      LOG_FATAL << "unknown error of accept4 " << savedErrno;
-      break;
-  }
-  if (savedErrno == EMFILE)
-  {
-    close(idleFd_);
-    idleFd_ = accept(listenFd_, NULL, NULL);
-    close(idleFd_);
-    idleFd_ = open("/dev/null", O_RDONLY | O_CLOEXEC);
-  }
-}
-
-void Server::newConnection(const int connfd, const struct sockaddr *clientAddr)
+namespace {
+void logNewConnection(const string& name, int connfd, const struct sockaddr *clientAddr)
 {
-  serverLoop_->assertInLoopThread();
-  EventLoop* loop = eventLoopThreadPool_->getNextLoop();
-  char ip[INET6_ADDRSTRLEN];
-  uint16_t port;
+  if (Logger::logLevel() > Logger::INFO) return;
+  struct sockaddr_storage peer;
+  if (clientAddr->sa_family == AF_UNSPEC)
+  {
+    // 完成式接受不带对端地址，只在要打日志时才查
+    socklen_t len = static_cast<socklen_t>(sizeof peer);
+    memset(&peer, 0, sizeof peer);
+    if (getpeername(connfd, reinterpret_cast<struct sockaddr*>(&peer), &len) == 0)
+    {
+      clientAddr = reinterpret_cast<const struct sockaddr*>(&peer);
+    }
+  }
+  char ip[INET6_ADDRSTRLEN] = "";
+  uint16_t port = 0;
   if (clientAddr->sa_family == AF_INET) {
       struct sockaddr_in *clientAddrIn = (struct sockaddr_in *)clientAddr;
       inet_ntop(AF_INET, &clientAddrIn->sin_addr, ip, sizeof(ip));
@@ -148,28 +248,148 @@ void Server::newConnection(const int connfd, const struct sockaddr *clientAddr)
       inet_ntop(AF_INET6, &clientAddrIn6->sin6_addr, ip, sizeof(ip));
       port = ntohs(clientAddrIn6->sin6_port);
   }
-  LOG_INFO << "Server::newConnection [" << name_
+  LOG_INFO << "Server::newConnection [" << name
            << "] - new connection from " << ip << ":"
            << port;
+}
+}  // namespace
+
+void Server::newConnection(const int connfd, const struct sockaddr *clientAddr)
+{
+  serverLoop_->assertInLoopThread();
+  setNoDelay(connfd, true);
+  // 优先交给收包 CPU 上的 Loop，协议栈处理和应用处理在同一个核上
+  EventLoop* loop = pinThreads_ ? eventLoopThreadPool_->getLoopForCpu(getIncomingCpu(connfd)) : NULL;
+  if (loop == NULL) loop = eventLoopThreadPool_->getNextLoop();
+  logNewConnection(name_, connfd, clientAddr);
+  // 连接对象从目标 Loop 的池中分配，必须在目标 Loop 中创建，等本轮接受结束后批量交出
+  const size_t index = std::find(loops_.begin(), loops_.end(), loop) - loops_.begin();
+  assert(index < loops_.size());
+  int fd = connfd;
+  acceptInboxes_[index]->push(std::move(fd));
+  // 本轮后面的连接选 Loop 时要看到这一个，不必等它在目标 Loop 中建立
+  loop->incomingConnectionQueued();
+  handoffPending_[index] = true;
+}
+
+void Server::handoffAccepted()
+{
+  serverLoop_->assertInLoopThread();
+  for (size_t i = 0; i < loops_.size(); ++i)
+  {
+    if (handoffPending_[i])
+    {
+      handoffPending_[i] = false;
+      loops_[i]->queueInLoop(std::bind(&Server::drainAcceptInbox, this, i));
+    }
+  }
+}
 
-  HttpServerPtr conn(new HttpServer(loop, connfd));
-  connections_[connfd] = conn;
+void Server::drainAcceptInbox(size_t index)
+{
+  EventLoop* loop = loops_[index];
+  loop->assertInLoopThread();
+  int connfd;
+  while (acceptInboxes_[index]->pop(&connfd))
+  {
+    establishConnection(loop, connfd);
+    loop->incomingConnectionTaken();
+  }
+}
+
+// 在接受连接的 I/O Loop 中直接建立连接，不经过主 Loop
+void Server::newLocalConnection(EventLoop* loop, const int connfd, const struct sockaddr *clientAddr)
+{
+  loop->assertInLoopThread();
+  setNoDelay(connfd, true);
+  logNewConnection(name_, connfd, clientAddr);
+  establishConnection(loop, connfd);
+}
+
+void Server::establishConnection(EventLoop* loop, const int connfd)
+{
+  loop->assertInLoopThread();
+  HttpServerPtr conn(std::allocate_shared<HttpServer>(
+      PoolAllocator<HttpServer>(loop->connectionPool()), loop, connfd));
   conn->setCloseCallback(
       std::bind(&Server::removeConnection, this, std::placeholders::_1));
-  loop->runInLoop(std::bind(&HttpServer::connectEstablished, conn));
+  conn->setWaterMarks(highWaterMark_, lowWaterMark_);
+  if (highWaterMarkCallback_)
+  {
+    conn->setHighWaterMarkCallback([this](const HttpServerPtr& c, size_t queued) {
+      highWaterMarkCallback_(c, queued);
+    });
+  }
+  if (lowWaterMarkCallback_)
+  {
+    conn->setLowWaterMarkCallback([this](const HttpServerPtr& c, size_t queued) {
+      lowWaterMarkCallback_(c, queued);
+    });
+  }
+  loop->addConnection(conn);
+  // 这两种方式下请求通常随连接一起到达，建立时直接读，省一轮 poll
+  conn->connectEstablished(deferAcceptSeconds_ > 0 || fastOpenQueueLen_ > 0);
 }
 
+// 连接关闭的整个过程都在连接所在的 Loop 中完成
 void Server::removeConnection(const HttpServerPtr& conn)
 {
-  serverLoop_->runInLoop(std::bind(&Server::removeConnectionInLoop, this, conn));
+  EventLoop* loop = conn->getLoop();
+  loop->assertInLoopThread();
+  loop->removeConnection(conn);
+  // 正在处理该连接的事件，销毁留到本轮的任务阶段
+  loop->queueInLoop(std::bind(&HttpServer::connectDestroyed, conn));
 }
 
-void Server::removeConnectionInLoop(const HttpServerPtr& conn)
+void Server::destroyConnections(EventLoop* loop)
+{
+  loop->assertInLoopThread();
+  const std::vector<HttpServerPtr>& conns = loop->connections();
+  for (size_t fd = 0; fd < conns.size(); ++fd)
+  {
+    HttpServerPtr conn(conns[fd]);
+    if (conn)
+    {
+      loop->removeConnection(conn);
+      conn->connectDestroyed();
+    }
+  }
+}
+
+// 把最忙 Loop 上的一部分连接迁到最闲的 Loop，连接数之差减半
+// 主 Loop 只看各 Loop 的连接数，挑选和迁移都在最忙的 Loop 中进行
+void Server::rebalance()
 {
   serverLoop_->assertInLoopThread();
-  size_t n = connections_.erase(conn->getFd());
-  (void)n;
-  assert(n == 1);
-  EventLoop* Loop = conn->getLoop();
-  Loop->queueInLoop(std::bind(&HttpServer::connectDestroyed, conn));
+  const std::vector<EventLoop*>& loops = loops_;
+  if (loops.size() < 2) return;
+  EventLoop* busiest = loops[0];
+  EventLoop* idlest = loops[0];
+  for (EventLoop* loop : loops)
+  {
+    if (loop->numConnections() > busiest->numConnections()) busiest = loop;
+    if (loop->numConnections() < idlest->numConnections()) idlest = loop;
+  }
+  const int diff = busiest->numConnections() - idlest->numConnections();
+  if (diff <= kRebalanceThreshold) return;
+
+  const int toMove = std::min(diff / 2, kMaxMigrationsPerRound);
+  LOG_INFO << "Server::rebalance [" << name_ << "] moving up to " << toMove
+           << " connections, load " << busiest->numConnections()
+           << " -> " << idlest->numConnections();
+  busiest->queueInLoop(std::bind(&Server::migrateConnections, busiest, idlest, toMove));
+}
+
+// 在 from 线程中挑出空闲的连接迁走，正在处理请求的连接留给下一轮
+void Server::migrateConnections(EventLoop* from, EventLoop* to, int count)
+{
+  from->assertInLoopThread();
+  // 迁走只会清空表项，不会改变表的大小
+  const std::vector<HttpServerPtr>& conns = from->connections();
+  int moved = 0;
+  for (size_t fd = 0; fd < conns.size() && moved < count; ++fd)
+  {
+    HttpServerPtr conn(conns[fd]);
+    if (conn && conn->migrateTo(to)) ++moved;
+  }
 }
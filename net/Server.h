@@ -1,43 +1,105 @@
 #ifndef SERVER_H
 #define SERVER_H
 
+#include "Acceptor.h"
 #include "Channel.h"
+#include "ConnectionPool.h"
 #include "EventLoop.h"
 #include "EventLoopThreadPool.h"
 #include "HttpServer.h"
+#include "base/MpscQueue.h"
+#include "base/WorkStealingPool.h"
+
+#include <vector>
 
 #define LISTENQ  4096
 
 class Server {
  public:
   typedef std::function<void(EventLoop*)> ThreadInitCallback;
+  typedef std::function<void(const HttpServerPtr&, size_t)> WaterMarkCallback;
+
+  enum AcceptMode {
+    kMainAcceptor,        // 主 Loop 接受连接，轮询分给 I/O Loop
+    kPerLoopAcceptors,    // 每个 I/O Loop 有自己的 SO_REUSEPORT 监听 socket，本地接受
+    kCpuSteeredAcceptors  // 同上，并用 CBPF 程序按收包 CPU 选择同一 CPU 上的 Loop 的监听 socket，需要绑核
+  };
+
   Server(EventLoop* loop, const int port, const string name, int numThreads, bool reuseport);
   ~Server();
   EventLoop* getLoop() const { return serverLoop_; }
+  // 在 start() 之前设置，每个 I/O 线程的 Loop 创建后调用
+  void setThreadInitCallback(const ThreadInitCallback& cb) { threadInitCallback_ = cb; }
+  // 在 start() 之前设置，非默认模式需要 reuseport 且至少一个 I/O 线程
+  void setAcceptMode(AcceptMode mode) { acceptMode_ = mode; }
+  // 在 start() 之前设置，I/O 线程绑核，主 Loop 按 SO_INCOMING_CPU 把连接交给同一 CPU 上的 Loop
+  void setPinThreads(bool on) { pinThreads_ = on; eventLoopThreadPool_->setPinThreads(on); }
+  // 在 start() 之前设置，每隔 seconds 秒把空闲连接从最忙的 Loop 迁到最闲的 Loop，0 关闭
+  void setRebalanceInterval(int seconds) { rebalanceInterval_ = seconds; }
+  // 在 start() 之前设置，CPU 密集的处理函数所用计算线程数，0 表示不单独建线程池
+  void setComputeThreads(int numThreads) { computeThreads_ = numThreads; }
+  // 在 start() 之前设置，监听 socket 的 TCP_DEFER_ACCEPT 秒数，0 关闭
+  void setDeferAccept(int seconds) { deferAcceptSeconds_ = seconds; }
+  // 在 start() 之前设置，TCP Fast Open 队列长度，0 关闭
+  void setFastOpen(int queueLen) { fastOpenQueueLen_ = queueLen; }
+  // 在 start() 之前设置，每个连接输出队列的高低水位（字节），high 为 0 关闭
+  void setOutputWaterMarks(size_t high, size_t low) {
+    highWaterMark_ = high;
+    lowWaterMark_ = low;
+  }
+  // 在 start() 之前设置，可选，连接越过高水位暂停读、回落到低水位恢复读时在其 Loop 线程中回调
+  void setHighWaterMarkCallback(const WaterMarkCallback& cb) { highWaterMarkCallback_ = cb; }
+  void setLowWaterMarkCallback(const WaterMarkCallback& cb) { lowWaterMarkCallback_ = cb; }
   void start();
+  // 每个 I/O Loop 一行统计，start() 之后任意线程可调用
+  string loopStats() const;
   int socket_bind(const int port, bool reuseport);
-  void handleNewConn();
 
  private:
   void newConnection(const int connfd, const struct sockaddr *clientAddr);
+  void newLocalConnection(EventLoop* loop, const int connfd, const struct sockaddr *clientAddr);
+  void handoffAccepted();
+  void drainAcceptInbox(size_t index);
+  void establishConnection(EventLoop* loop, const int connfd);
   void removeConnection(const HttpServerPtr& conn);
-  void removeConnectionInLoop(const HttpServerPtr& conn);
-  
-  typedef std::map<int, HttpServerPtr> ConnectionMap;
+  static void destroyConnections(EventLoop* loop);
+  void startLoopAcceptors();
+  void attachCpuSteering();
+  void setListenOptions(int listenFd);
+  void rebalance();
+  static void migrateConnections(EventLoop* from, EventLoop* to, int count);
 
   bool started_;
-  bool listening_;
   EventLoop* serverLoop_;
   const int port_;
   const string name_;
+  const bool reuseport_;
+  AcceptMode acceptMode_;
+  bool pinThreads_;
+  int rebalanceInterval_;
+  int computeThreads_;
+  int deferAcceptSeconds_;
+  int fastOpenQueueLen_;
+  size_t highWaterMark_;
+  size_t lowWaterMark_;
   int listenFd_;
-  int idleFd_;
   std::shared_ptr<EventLoopThreadPool> eventLoopThreadPool_;
   // 初始化 Loop 回调
   ThreadInitCallback threadInitCallback_;
-  std::unique_ptr<Channel> acceptChannel_;
-
-  ConnectionMap connections_;
+  WaterMarkCallback highWaterMarkCallback_;
+  WaterMarkCallback lowWaterMarkCallback_;
+  std::unique_ptr<Acceptor> acceptor_;
+  // 每个 I/O Loop 一个，只在对应 Loop 线程中使用和析构
+  std::vector<Acceptor*> loopAcceptors_;
+  // 周期触发 rebalance
+  TimerId rebalanceTimer_;
+  std::unique_ptr<WorkStealingPool> computePool_;
+  // start() 时的快照，之后只读
+  std::vector<EventLoop*> loops_;
+  // 主 Acceptor 模式下每个 I/O Loop 一个收件箱，与 loops_ 下标对应
+  // 一次接受循环中的连接先放进各自的收件箱，循环结束后每个 Loop 只投递一个任务、唤醒一次
+  std::vector<std::unique_ptr<MpscQueue<int>>> acceptInboxes_;
+  std::vector<bool> handoffPending_;
 };
 
 #endif
@@ -1,72 +1,235 @@
 #include "Timer.h"
 
-#include <sys/time.h>
+#include <assert.h>
+#include <time.h>
 
-TimerNode::TimerNode(HttpServerPtr httpServer, int timeout)
-    : deleted_(false), httpServer_(httpServer) {
-  struct timeval now;
-  gettimeofday(&now, NULL);
-  expiredTime_ = (((now.tv_sec % 10000) * 1000) + (now.tv_usec / 1000)) + timeout;
+namespace {
+const uint64_t kNoDeadline = ~0ULL;
+}  // namespace
+
+int64_t monotonicMilliseconds()
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return static_cast<int64_t>(ts.tv_sec) * 1000 + ts.tv_nsec / 1000000;
 }
 
+const int TimerManager::kRootBits;
+const int TimerManager::kLevelBits;
+const int TimerManager::kNumLevels;
+const int TimerManager::kRootSize;
+const int TimerManager::kLevelSize;
+
 TimerNode::~TimerNode()
 {
-  if (httpServer_) httpServer_->timeoutClose();
+  assert(!isActive());
 }
 
-TimerNode::TimerNode(TimerNode &tn)
-    : httpServer_(tn.httpServer_), expiredTime_(0) {}
+TimerManager::TimerManager()
+    : baseMs_(monotonicMilliseconds()), currentTick_(0), nextDeadline_(kNoDeadline), count_(0)
+{
+  for (int i = 0; i < kRootSize; ++i) initList(&root_[i]);
+  for (int level = 0; level < kNumLevels; ++level)
+  {
+    for (int i = 0; i < kLevelSize; ++i) initList(&levels_[level][i]);
+  }
+}
 
-void TimerNode::update(int timeout)
+TimerManager::~TimerManager()
 {
-  struct timeval now;
-  gettimeofday(&now, NULL);
-  expiredTime_ = (((now.tv_sec % 10000) * 1000) + (now.tv_usec / 1000)) + timeout;
+  // 剩下的节点属于还没销毁的对象，只摘下不触发
+  for (int i = 0; i < kRootSize; ++i)
+  {
+    while (!listEmpty(&root_[i])) root_[i].next->unlink();
+  }
+  for (int level = 0; level < kNumLevels; ++level)
+  {
+    for (int i = 0; i < kLevelSize; ++i)
+    {
+      while (!listEmpty(&levels_[level][i])) levels_[level][i].next->unlink();
+    }
+  }
 }
 
-bool TimerNode::isValid()
+void TimerManager::append(TimerLink* head, TimerNode* node)
 {
-  bool ok = true;
-  struct timeval now;
-  gettimeofday(&now, NULL);
-  size_t temp = (((now.tv_sec % 10000) * 1000) + (now.tv_usec / 1000));
-  if (temp >= expiredTime_)
+  node->prev = head->prev;
+  node->next = head;
+  head->prev->next = node;
+  head->prev = node;
+}
+
+void TimerManager::splice(TimerLink* from, TimerLink* to)
+{
+  if (listEmpty(from)) return;
+  TimerLink* first = from->next;
+  TimerLink* last = from->prev;
+  first->prev = to->prev;
+  to->prev->next = first;
+  last->next = to;
+  to->prev = last;
+  initList(from);
+}
+
+uint64_t TimerManager::nowTick() const
+{
+  return static_cast<uint64_t>(monotonicMilliseconds() - baseMs_);
+}
+
+void TimerManager::place(TimerNode* node)
+{
+  uint64_t expires = node->expires_;
+  const uint64_t delta = expires - currentTick_;
+  TimerLink* head;
+  if (expires < currentTick_)
   {
-    setDeleted();
-    ok = false;
+    // 已经到期，下一个 tick 处理
+    head = &root_[currentTick_ & (kRootSize - 1)];
   }
-  return ok;
+  else if (delta < (1ULL << kRootBits))
+  {
+    head = &root_[expires & (kRootSize - 1)];
+  }
+  else
+  {
+    int level = 0;
+    while (level < kNumLevels - 1 && delta >= (1ULL << (kRootBits + (level + 1) * kLevelBits)))
+    {
+      ++level;
+    }
+    const uint64_t maxDelta = (1ULL << (kRootBits + kNumLevels * kLevelBits)) - 1;
+    if (delta > maxDelta)
+    {
+      // 超出轮的范围，先挂在最远处，到时候再重新分配
+      expires = currentTick_ + maxDelta;
+    }
+    const int shift = kRootBits + level * kLevelBits;
+    head = &levels_[level][(expires >> shift) & (kLevelSize - 1)];
+  }
+  append(head, node);
 }
 
-void TimerNode::clear()
+int TimerManager::cascade(int level, int index)
 {
-  httpServer_.reset();
-  setDeleted();
+  TimerLink list;
+  initList(&list);
+  splice(&levels_[level][index], &list);
+  while (!listEmpty(&list))
+  {
+    TimerNode* node = front(&list);
+    node->unlink();
+    place(node);
+  }
+  return index;
 }
 
-TimerManager::TimerManager() {}
+void TimerManager::addTimer(TimerNode* node, int timeout)
+{
+  if (node->isActive())
+  {
+    node->unlink();
+  }
+  else
+  {
+    ++count_;
+  }
+  node->expires_ = nowTick() + static_cast<uint64_t>(timeout > 0 ? timeout : 0);
+  place(node);
+  if (node->expires_ < nextDeadline_) nextDeadline_ = node->expires_;
+}
 
-TimerManager::~TimerManager() {}
+void TimerManager::cancelTimer(TimerNode* node)
+{
+  if (node->isActive())
+  {
+    node->unlink();
+    --count_;
+  }
+}
 
-void TimerManager::addTimer(HttpServerPtr httpServer_, int timeout)
+int TimerManager::remaining(const TimerNode* node) const
 {
-  TimerNodePtr new_node(new TimerNode(httpServer_, timeout));
-  timerNodeQueue.push(new_node);
-  httpServer_->linkTimer(new_node);
+  if (!node->isActive()) return -1;
+  const uint64_t now = nowTick();
+  return node->expires_ > now ? static_cast<int>(node->expires_ - now) : 0;
 }
 
 void TimerManager::handleExpiredEvent()
 {
-  while (!timerNodeQueue.empty()) {
-    TimerNodePtr ptimer_now = timerNodeQueue.top();
-    if (ptimer_now->isDeleted())
+  const uint64_t now = nowTick();
+  if (count_ == 0)
+  {
+    // 轮是空的，直接跳到当前时间
+    if (currentTick_ <= now) currentTick_ = now + 1;
+    return;
+  }
+  TimerLink expired;
+  initList(&expired);
+  while (currentTick_ <= now && count_ > 0)
+  {
+    const int index = static_cast<int>(currentTick_ & (kRootSize - 1));
+    if (index == 0)
+    {
+      // 第 0 层转完一圈，逐层把上层当前槽的节点分配下来
+      for (int level = 0; level < kNumLevels; ++level)
+      {
+        const int shift = kRootBits + level * kLevelBits;
+        if (cascade(level, static_cast<int>((currentTick_ >> shift) & (kLevelSize - 1))) != 0)
+        {
+          break;
+        }
+      }
+    }
+    ++currentTick_;
+    splice(&root_[index], &expired);
+    // 回调里可能重新设置或取消其他节点，每次只取链表头
+    while (!listEmpty(&expired))
     {
-      timerNodeQueue.pop();
+      TimerNode* node = front(&expired);
+      node->unlink();
+      --count_;
+      if (node->callback_) node->callback_();
     }
-    else if (!ptimer_now->isValid())
+  }
+  if (count_ == 0 && currentTick_ <= now) currentTick_ = now + 1;
+  nextDeadline_ = computeNextDeadline();
+}
+
+uint64_t TimerManager::computeNextDeadline() const
+{
+  if (count_ == 0) return kNoDeadline;
+  // 第 0 层的槽精确到 tick，第一个非空槽就是最早到期的时刻
+  for (int i = 0; i < kRootSize; ++i)
+  {
+    const uint64_t tick = currentTick_ + i;
+    if (!listEmpty(&root_[tick & (kRootSize - 1)])) return tick;
+  }
+  // 高层的槽只知道何时下放：第 level 层第 slot 个槽在 tick 是 2^shift 的倍数且
+  // (tick >> shift) & 63 == slot 时下放，此时刻不晚于其中任何节点的到期时刻
+  uint64_t deadline = kNoDeadline;
+  for (int level = 0; level < kNumLevels; ++level)
+  {
+    const int shift = kRootBits + level * kLevelBits;
+    const uint64_t unit = 1ULL << shift;
+    const uint64_t first = (currentTick_ + unit - 1) >> shift;
+    for (int i = 0; i < kLevelSize; ++i)
     {
-      timerNodeQueue.pop();
+      const uint64_t u = first + i;
+      if (!listEmpty(&levels_[level][u & (kLevelSize - 1)]))
+      {
+        if ((u << shift) < deadline) deadline = u << shift;
+        break;
+      }
     }
-    else break;
   }
+  return deadline;
+}
+
+int TimerManager::nextTimeout()
+{
+  if (nextDeadline_ == kNoDeadline) return -1;
+  const uint64_t now = nowTick();
+  if (nextDeadline_ <= now) return 0;
+  const uint64_t delta = nextDeadline_ - now;
+  return delta > 0x7fffffff ? 0x7fffffff : static_cast<int>(delta);
 }
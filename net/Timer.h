@@ -1,48 +1,111 @@
 #ifndef TIMER_H
 #define TIMER_H
 
-#include <unistd.h>
-#include <deque>
-#include <memory>
-#include <queue>
+#include <stdint.h>
 
-#include "HttpServer.h"
+#include "base/InlineFunction.h"
+#include "base/noncopyable.h"
 
-class TimerNode {
+// CLOCK_MONOTONIC 毫秒，EventLoop::runAt 使用的时间基准
+int64_t monotonicMilliseconds();
+
+struct LoopTimer;
+
+// EventLoop::runAt/runAfter/runEvery 返回的句柄，只用于取消，可以复制到其他线程
+class TimerId {
  public:
-  TimerNode(HttpServerPtr requestServer, int timeout);
-  ~TimerNode();
-  TimerNode(TimerNode &tn);
-  void update(int timeout);
-  bool isValid();
-  void clear();
-  void setDeleted() { deleted_ = true; }
-  bool isDeleted() const { return deleted_; }
-  size_t getExpTime() const { return expiredTime_; }
+  TimerId() : timer_(NULL), sequence_(0) {}
+  bool valid() const { return timer_ != NULL; }
 
  private:
-  bool deleted_;
-  size_t expiredTime_;
-  HttpServerPtr httpServer_;
+  friend class EventLoop;
+  TimerId(LoopTimer* timer, uint32_t sequence) : timer_(timer), sequence_(sequence) {}
+
+  LoopTimer* timer_;
+  uint32_t sequence_;  // 定时器对象被回收复用后序号改变，旧句柄失效
 };
 
-struct TimerCmp {
-  bool operator()(std::shared_ptr<TimerNode> &a,
-                  std::shared_ptr<TimerNode> &b) const {
-    return a->getExpTime() > b->getExpTime();
+// 时间轮槽位的双向循环链表
+struct TimerLink {
+  TimerLink() : prev(NULL), next(NULL) {}
+
+  void unlink() {
+    prev->next = next;
+    next->prev = prev;
+    prev = next = NULL;
   }
+
+  TimerLink* prev;
+  TimerLink* next;
 };
 
-class TimerManager {
+// 嵌在所属对象（如连接）里的定时器节点，重新设置只是移动链表指针，不分配内存
+// 只能在所属 Loop 线程中使用，析构前必须已经取消或触发
+class TimerNode : private TimerLink, noncopyable {
+ public:
+  typedef InlineFunction<void(), 32> Callback;
+
+  TimerNode() : expires_(0) {}
+  ~TimerNode();
+
+  // 到期时调用，调用前节点已经摘下
+  void setCallback(Callback&& cb) { callback_ = std::move(cb); }
+  bool isActive() const { return next != NULL; }
+
+ private:
+  friend class TimerManager;
+
+  uint64_t expires_;  // 到期的 tick
+  Callback callback_;
+};
+
+// 分层时间轮，1 tick = 1ms
+// 第 0 层 256 个槽，精确到 tick；之后 4 层各 64 个槽，每层跨度是上一层的 64 倍，共覆盖 2^32 tick
+// 第 0 层转完一圈时把上一层对应槽里的节点重新分配到下层（cascade）
+// 添加、重新设置、取消都是 O(1)
+class TimerManager : noncopyable {
  public:
   TimerManager();
   ~TimerManager();
-  void addTimer(std::shared_ptr<HttpServer> SPHttpServer, int timeout);
+
+  // node 已经在轮上时先摘下，timeout 毫秒后到期
+  void addTimer(TimerNode* node, int timeout);
+  void cancelTimer(TimerNode* node);
+  // 距离到期还有多少毫秒，不在轮上返回 -1
+  int remaining(const TimerNode* node) const;
+  // 触发所有已到期的节点
   void handleExpiredEvent();
+  // 到下一个需要处理的时刻还有多少毫秒，没有定时器返回 -1，可以作为 poll 的超时
+  // 只会比最早的到期时刻早（高层槽位下放的时刻），不会晚
+  int nextTimeout();
 
  private:
-  typedef std::shared_ptr<TimerNode> TimerNodePtr;
-  std::priority_queue<TimerNodePtr, std::deque<TimerNodePtr>, TimerCmp> timerNodeQueue;
+  static const int kRootBits = 8;
+  static const int kLevelBits = 6;
+  static const int kNumLevels = 4;
+  static const int kRootSize = 1 << kRootBits;
+  static const int kLevelSize = 1 << kLevelBits;
+
+  static void initList(TimerLink* head) { head->prev = head->next = head; }
+  static bool listEmpty(const TimerLink* head) { return head->next == head; }
+  static TimerNode* front(TimerLink* head) { return static_cast<TimerNode*>(head->next); }
+  static void append(TimerLink* head, TimerNode* node);
+  // 把 from 中的节点整体移到 to，from 变为空
+  static void splice(TimerLink* from, TimerLink* to);
+
+  uint64_t nowTick() const;
+  void place(TimerNode* node);
+  int cascade(int level, int index);
+  uint64_t computeNextDeadline() const;
+
+  int64_t baseMs_;
+  // 下一个要处理的 tick
+  uint64_t currentTick_;
+  // 下一个需要处理的 tick 的下界，添加时直接取小，处理过后重新计算；取消不更新，最多多醒一次
+  uint64_t nextDeadline_;
+  int count_;
+  TimerLink root_[kRootSize];
+  TimerLink levels_[kNumLevels][kLevelSize];
 };
 
 #endif  // TIMER_H
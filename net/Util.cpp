@@ -1,5 +1,7 @@
 #include "Util.h"
 
+#include <errno.h>
+#include <linux/filter.h>
 #include <netinet/in.h>
 #include <netinet/tcp.h>
 #include <signal.h>
@@ -50,3 +52,83 @@ bool setNoDelay(int sockfd, bool on)
 
   return ret == 0 || !on;
 }
+
+bool setBusyPoll(int sockfd, int usec)
+{
+#ifdef SO_BUSY_POLL
+  int ret = setsockopt(sockfd, SOL_SOCKET, SO_BUSY_POLL,
+                       &usec, static_cast<socklen_t>(sizeof usec));
+  return ret == 0;
+#else
+  return false;
+#endif
+}
+
+bool setDeferAccept(int sockfd, int seconds)
+{
+  int ret = setsockopt(sockfd, IPPROTO_TCP, TCP_DEFER_ACCEPT,
+                       &seconds, static_cast<socklen_t>(sizeof seconds));
+  return ret == 0;
+}
+
+bool setFastOpen(int sockfd, int queueLen)
+{
+#ifdef TCP_FASTOPEN
+  int ret = setsockopt(sockfd, IPPROTO_TCP, TCP_FASTOPEN,
+                       &queueLen, static_cast<socklen_t>(sizeof queueLen));
+  return ret == 0;
+#else
+  return false;
+#endif
+}
+
+bool setReusePortCpuSteering(int sockfd, const std::vector<int>& socketOfCpu)
+{
+#ifdef SO_ATTACH_REUSEPORT_CBPF
+  // A = 当前 CPU; 对表中每个 CPU：if (A == cpu) return 编号; 都不是时返回越界值，内核退回哈希
+  std::vector<struct sock_filter> code;
+  struct sock_filter load = { BPF_LD | BPF_W | BPF_ABS, 0, 0, static_cast<__u32>(SKF_AD_OFF + SKF_AD_CPU) };
+  code.push_back(load);
+  for (size_t cpu = 0; cpu < socketOfCpu.size(); ++cpu)
+  {
+    if (socketOfCpu[cpu] < 0) continue;
+    struct sock_filter test = { BPF_JMP | BPF_JEQ | BPF_K, 0, 1, static_cast<__u32>(cpu) };
+    struct sock_filter ret = { BPF_RET | BPF_K, 0, 0, static_cast<__u32>(socketOfCpu[cpu]) };
+    code.push_back(test);
+    code.push_back(ret);
+  }
+  struct sock_filter fallback = { BPF_RET | BPF_K, 0, 0, 0xffffffff };
+  code.push_back(fallback);
+  if (code.size() > BPF_MAXINSNS)
+  {
+    errno = E2BIG;
+    return false;
+  }
+  struct sock_fprog prog;
+  prog.len = static_cast<unsigned short>(code.size());
+  prog.filter = code.data();
+  int ret = setsockopt(sockfd, SOL_SOCKET, SO_ATTACH_REUSEPORT_CBPF,
+                       &prog, static_cast<socklen_t>(sizeof prog));
+  return ret == 0;
+#else
+  (void)sockfd;
+  (void)socketOfCpu;
+  return false;
+#endif
+}
+
+int getIncomingCpu(int sockfd)
+{
+#ifdef SO_INCOMING_CPU
+  int cpu = -1;
+  socklen_t len = static_cast<socklen_t>(sizeof cpu);
+  if (getsockopt(sockfd, SOL_SOCKET, SO_INCOMING_CPU, &cpu, &len) < 0)
+  {
+    return -1;
+  }
+  return cpu;
+#else
+  (void)sockfd;
+  return -1;
+#endif
+}
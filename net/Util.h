@@ -3,6 +3,8 @@
 
 #include "base/Logging.h"
 
+#include <vector>
+
 #define CHECK_NOTNULL(val) CheckNotNull(__FILE__, __LINE__, "'" #val "' Must be non NULL", (val))
 
 template <typename T>
@@ -21,5 +23,15 @@ bool setReuseAddr(int sockfd, bool on);
 bool setReusePort(int sockfd, bool on);
 bool setKeepAlive(int sockfd, bool on);
 bool setNoDelay(int sockfd, bool on);
+bool setBusyPoll(int sockfd, int usec);
+// 监听 socket：连接上有数据到达（或超过 seconds 秒）才完成 accept
+bool setDeferAccept(int sockfd, int seconds);
+// 监听 socket：服务端 TCP Fast Open，queueLen 是未完成握手的 TFO 请求队列长度
+bool setFastOpen(int sockfd, int queueLen);
+// 给 reuseport 组挂 CBPF 程序：按收包 CPU 选择组内的 socket，socketOfCpu[cpu] 为编号，
+// 负数或表外的 CPU 由内核按四元组哈希选择
+bool setReusePortCpuSteering(int sockfd, const std::vector<int>& socketOfCpu);
+// 最后处理该连接收包的 CPU（SO_INCOMING_CPU），失败返回 -1
+int getIncomingCpu(int sockfd);
 
 #endif  // UTIL_H
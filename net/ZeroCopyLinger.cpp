@@ -0,0 +1,112 @@
+#include "ZeroCopyLinger.h"
+
+#include "Channel.h"
+#include "EventLoop.h"
+#include "base/Logging.h"
+
+#include <sys/socket.h>
+#include <unistd.h>
+
+const int ZeroCopyLinger::kLingerTimeoutMs;
+
+namespace {
+
+// 下次 close 时发 RST，内核立即清空发送队列，不再引用数据块
+void setAbortiveClose(int fd)
+{
+  struct linger lg;
+  lg.l_onoff = 1;
+  lg.l_linger = 0;
+  ::setsockopt(fd, SOL_SOCKET, SO_LINGER, &lg, static_cast<socklen_t>(sizeof lg));
+}
+
+}  // namespace
+
+ZeroCopyLinger::ZeroCopyLinger(EventLoop* loop) : loop_(loop) {}
+
+ZeroCopyLinger::~ZeroCopyLinger()
+{
+  for (auto& item : entries_)
+  {
+    Entry* entry = item.second.get();
+    if (!entry->done)
+    {
+      setAbortiveClose(item.first);
+      entry->channel->disableAll();
+      entry->channel->remove();
+    }
+  }
+}
+
+void ZeroCopyLinger::add(int fd, OutputQueue::ZeroCopyPins&& pins)
+{
+  loop_->assertInLoopThread();
+  int lingerFd = ::dup(fd);
+  if (lingerFd < 0)
+  {
+    // 没法继续等完成通知，只能中止连接
+    LOG_SYSERR << "ZeroCopyLinger::add dup";
+    setAbortiveClose(fd);
+    return;
+  }
+  // 原 fd 关闭时还有这个副本，连接不会结束，需要主动发 FIN
+  ::shutdown(lingerFd, SHUT_WR);
+
+  std::unique_ptr<Entry> entry(new Entry);
+  entry->channel.reset(new Channel(loop_, lingerFd));
+  entry->pins = std::move(pins);
+  entry->done = false;
+  // 不读数据，只关心 EPOLLERR（错误队列）和 EPOLLHUP
+  entry->channel->setErrorHandler(std::bind(&ZeroCopyLinger::handleEvent, this, lingerFd));
+  entry->channel->setCloseHandler(std::bind(&ZeroCopyLinger::handleEvent, this, lingerFd));
+  entry->channel->setET();
+  entry->timer =
+      loop_->runAfter(kLingerTimeoutMs, std::bind(&ZeroCopyLinger::handleTimeout, this, lingerFd));
+  entries_[lingerFd] = std::move(entry);
+}
+
+void ZeroCopyLinger::handleEvent(int fd)
+{
+  auto it = entries_.find(fd);
+  if (it == entries_.end() || it->second->done) return;
+  Entry* entry = it->second.get();
+  OutputQueue::reapZeroCopyCompletions(fd, &entry->pins);
+  if (entry->pins.empty())
+  {
+    loop_->cancel(entry->timer);
+    finish(entry);
+  }
+}
+
+void ZeroCopyLinger::handleTimeout(int fd)
+{
+  auto it = entries_.find(fd);
+  if (it == entries_.end() || it->second->done) return;
+  Entry* entry = it->second.get();
+  OutputQueue::reapZeroCopyCompletions(fd, &entry->pins);
+  if (!entry->pins.empty())
+  {
+    LOG_WARN << "zerocopy completions still pending on fd " << fd << " after "
+             << kLingerTimeoutMs << "ms, resetting connection";
+    setAbortiveClose(fd);
+  }
+  finish(entry);
+}
+
+void ZeroCopyLinger::finish(Entry* entry)
+{
+  entry->done = true;
+  entry->channel->disableAll();
+  entry->channel->remove();
+  // 可能正处在这个 Channel 的事件回调中，下一轮再析构（关闭 fd、释放数据块）
+  // fd 在那之前不会被复用
+  loop_->queueInLoop(std::bind(&ZeroCopyLinger::destroy, this, entry->channel->getFd()));
+}
+
+void ZeroCopyLinger::destroy(int fd)
+{
+  auto it = entries_.find(fd);
+  // 先关 fd，内核才能在 RST 时清空发送队列，之后释放数据块
+  it->second->channel.reset();
+  entries_.erase(it);
+}
@@ -0,0 +1,46 @@
+#ifndef ZEROCOPYLINGER_H
+#define ZEROCOPYLINGER_H
+
+#include "OutputQueue.h"
+#include "Timer.h"
+#include "base/noncopyable.h"
+
+#include <memory>
+#include <unordered_map>
+
+class Channel;
+class EventLoop;
+
+// 每个 EventLoop 一个，接管关闭时还有零拷贝数据块没被内核释放的连接
+// 复制一个 fd 保持 socket 打开（写端已 shutdown，FIN 照常发出），继续读错误队列，
+// 数据块全部释放后才真正关闭；超时则发 RST 让内核丢掉发送队列再释放
+class ZeroCopyLinger : noncopyable {
+ public:
+  static const int kLingerTimeoutMs = 30 * 1000;
+
+  explicit ZeroCopyLinger(EventLoop* loop);
+  ~ZeroCopyLinger();
+
+  // 在 Loop 线程中调用，fd 仍归调用者所有
+  void add(int fd, OutputQueue::ZeroCopyPins&& pins);
+  size_t size() const { return entries_.size(); }
+
+ private:
+  struct Entry {
+    std::unique_ptr<Channel> channel;
+    OutputQueue::ZeroCopyPins pins;
+    TimerId timer;
+    bool done;
+  };
+
+  void handleEvent(int fd);
+  void handleTimeout(int fd);
+  void finish(Entry* entry);
+  void destroy(int fd);
+
+  EventLoop* loop_;
+  // 以复制出的 fd 为键
+  std::unordered_map<int, std::unique_ptr<Entry>> entries_;
+};
+
+#endif  // ZEROCOPYLINGER_H
@@ -0,0 +1,122 @@
+// 检查小响应（响应头和响应体）由服务器一次写出：客户端只收到一个带数据的报文段
+// 静态文件、处理函数和计算线程池中的处理函数各检查一次
+// 用法：HTTPClient [port]，在子进程中启动服务器，通过 TCP_INFO 的 tcpi_data_segs_in 计数
+// （glibc 的 netinet/tcp.h 里没有这个字段，用内核头文件）
+#include <arpa/inet.h>
+#include <linux/tcp.h>
+#include <netinet/in.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <string>
+
+#include "net/EventLoop.h"
+#include "net/HttpServer.h"
+#include "net/Server.h"
+
+namespace
+{
+
+uint64_t fib(int n) { return n < 2 ? n : fib(n - 1) + fib(n - 2); }
+
+int connectTo(int port)
+{
+  struct sockaddr_in addr;
+  memset(&addr, 0, sizeof addr);
+  addr.sin_family = AF_INET;
+  addr.sin_port = htons(static_cast<uint16_t>(port));
+  addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  // 服务器可能还没开始监听
+  for (int i = 0; i < 50; ++i)
+  {
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (connect(fd, reinterpret_cast<struct sockaddr*>(&addr), sizeof addr) == 0)
+    {
+      return fd;
+    }
+    close(fd);
+    usleep(100 * 1000);
+  }
+  return -1;
+}
+
+// 请求 path（Connection: close），读到对端关闭，返回收到的带数据报文段数，出错返回 -1
+int dataSegmentsFor(int port, const char* path, std::string* response)
+{
+  int fd = connectTo(port);
+  if (fd < 0) return -1;
+  std::string request = std::string("GET ") + path + " HTTP/1.1\r\nHost: test\r\nConnection: close\r\n\r\n";
+  if (write(fd, request.data(), request.size()) != static_cast<ssize_t>(request.size()))
+  {
+    close(fd);
+    return -1;
+  }
+  char buf[4096];
+  ssize_t n;
+  while ((n = read(fd, buf, sizeof buf)) > 0)
+  {
+    response->append(buf, n);
+  }
+  struct tcp_info info;
+  socklen_t len = static_cast<socklen_t>(sizeof info);
+  memset(&info, 0, sizeof info);
+  int ret = getsockopt(fd, IPPROTO_TCP, TCP_INFO, &info, &len);
+  close(fd);
+  return ret == 0 ? static_cast<int>(info.tcpi_data_segs_in) : -1;
+}
+
+bool expectOneSegment(int port, const char* path, const char* bodyPart)
+{
+  std::string response;
+  int segments = dataSegmentsFor(port, path, &response);
+  bool ok = segments == 1 && response.find(bodyPart) != std::string::npos;
+  printf("%s %s: %d data segment(s), %zu bytes\n", ok ? "PASS" : "FAIL", path, segments,
+         response.size());
+  return ok;
+}
+
+}  // namespace
+
+int main(int argc, char* argv[])
+{
+  const int port = argc > 1 ? atoi(argv[1]) : 18080;
+  pid_t child = fork();
+  if (child < 0)
+  {
+    perror("fork");
+    return 1;
+  }
+  if (child == 0)
+  {
+    // 处理函数的响应走 sendResponse，/hello 走静态文件逻辑中的数据块
+    HttpServer::registerHandler("/ping", [](const HttpRequest&, HttpResponse* response) {
+      response->body = "pong\n";
+    });
+    // CPU 密集的处理函数，在计算线程池中运行，/fib?n=10 用递归计算斐波那契数
+    HttpServer::registerHandler("/fib", [](const HttpRequest& request, HttpResponse* response) {
+      int n = 0;
+      if (request.query.compare(0, 3, "?n=") == 0) n = atoi(request.query.c_str() + 3);
+      if (n < 0 || n > 40) n = 0;
+      response->body = std::to_string(fib(n)) + "\n";
+    }, true);
+    EventLoop loop;
+    Server server(&loop, port, "HTTPClient test", 1, true);
+    server.setComputeThreads(2);
+    server.start();
+    loop.loop();
+    _exit(0);
+  }
+
+  bool ok = expectOneSegment(port, "/hello", "Hello");
+  ok = expectOneSegment(port, "/ping", "pong") && ok;
+  ok = expectOneSegment(port, "/fib?n=10", "\r\n\r\n55\n") && ok;
+  kill(child, SIGTERM);
+  waitpid(child, NULL, 0);
+  return ok ? 0 : 1;
+}